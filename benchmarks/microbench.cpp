@@ -0,0 +1,486 @@
+/* Microbenchmarks for the hot kernels: EDC/ECC encoding, the 1ST_READ.BIN
+ * scrambler, ELF flattening and WAV loading.
+ *
+ * Each kernel is run repeatedly for at least --min-time seconds. Results are
+ * given per sector and as GB/s. For the sector encoders a sector is one raw
+ * 2352 byte sector; for everything else it's 2048 bytes of input, so the
+ * numbers can be compared with the data track encoding rate.
+ *
+ * On Linux, --perf also reads hardware counters (cycles, instructions and
+ * cache misses) through perf_event_open.
+ *
+ * Usage: mkdcdisc-microbench [--filter TEXT] [--min-time SECONDS] [--perf]
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "disc_image/edc/libedc.h"
+}
+
+#include "elf.h"
+#include "elf_parser.hpp"
+#include "scramble.h"
+#include "wav.h"
+
+/* Hardware counters for the calling thread, read as a group */
+class PerfCounters {
+public:
+    enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, COUNT };
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for(int fd: m_Fds) {
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    bool open() {
+#ifdef __linux__
+        const uint64_t configs[COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES
+        };
+
+        for(int i = 0; i < COUNT; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = (i == 0);
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            m_Fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : m_Fds[0], 0);
+            if(m_Fds[i] < 0) {
+                return false;
+            }
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void start() {
+#ifdef __linux__
+        ioctl(m_Fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_Fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    bool stop(uint64_t values[COUNT]) {
+#ifdef __linux__
+        ioctl(m_Fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        uint64_t group[1 + COUNT];
+        if(read(m_Fds[0], group, sizeof(group)) != sizeof(group)) {
+            return false;
+        }
+
+        for(int i = 0; i < COUNT; ++i) {
+            values[i] = group[1 + i];
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    int m_Fds[COUNT] = {-1, -1, -1};
+};
+
+struct Options {
+    std::string filter;
+    double min_time = 0.5;
+    bool perf = false;
+};
+
+static Options OPTIONS;
+static PerfCounters PERF;
+static bool PERF_AVAILABLE = false;
+
+/* Runs fn (which processes `sectors` sectors of `sector_size` bytes per call)
+ * until min_time has passed and prints the results */
+static void run(const std::string& name, double sectors, double sector_size, const std::function<void()>& fn) {
+    if(!OPTIONS.filter.empty() && name.find(OPTIONS.filter) == std::string::npos) {
+        return;
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    /* Warm up, then find how many calls take long enough to measure */
+    fn();
+
+    uint64_t calls = 1;
+    double elapsed = 0;
+    uint64_t counters[PerfCounters::COUNT] = {0};
+    bool have_counters = false;
+
+    while(true) {
+        if(PERF_AVAILABLE) {
+            PERF.start();
+        }
+
+        auto start = clock::now();
+        for(uint64_t i = 0; i < calls; ++i) {
+            fn();
+        }
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+        if(PERF_AVAILABLE) {
+            have_counters = PERF.stop(counters);
+        }
+
+        if(elapsed >= OPTIONS.min_time) {
+            break;
+        }
+
+        /* Aim a little past min_time so the next round is the last */
+        double scale = (elapsed > 0) ? (OPTIONS.min_time * 1.2) / elapsed : 100;
+        calls = std::max<uint64_t>(calls * 2, uint64_t(calls * std::min(scale, 100.0)));
+    }
+
+    double total_sectors = sectors * calls;
+    double ns_per_sector = elapsed * 1e9 / total_sectors;
+    double gb_per_second = (total_sectors * sector_size) / elapsed / 1e9;
+
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(12) << ns_per_sector
+              << std::setprecision(3) << std::setw(10) << gb_per_second;
+
+    if(have_counters) {
+        double cycles = counters[PerfCounters::CYCLES];
+        double instructions = counters[PerfCounters::INSTRUCTIONS];
+        std::cout << std::setprecision(1) << std::setw(14) << cycles / total_sectors
+                  << std::setprecision(2) << std::setw(8) << ((cycles) ? instructions / cycles : 0)
+                  << std::setprecision(3) << std::setw(16) << counters[PerfCounters::CACHE_MISSES] / total_sectors;
+    }
+
+    std::cout << std::endl;
+}
+
+static std::vector<uint8_t> random_bytes(size_t len, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> out(len);
+    for(auto& b: out) {
+        b = uint8_t(rng());
+    }
+    return out;
+}
+
+/* A sector laid out as do_encode_L2() expects: 12 bytes of sync and 4 of
+ * header, then the user data */
+static std::vector<uint8_t> make_sector(unsigned seed) {
+    auto sector = random_bytes(2352, seed);
+    const uint8_t subheader[8] = {0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x09, 0x00};
+    memcpy(&sector[16], subheader, sizeof(subheader));
+    return sector;
+}
+
+static void bench_edc_ecc() {
+    auto sector = make_sector(1);
+    uint8_t* data = &sector[0];
+
+    run("build_edc", 1, 2352, [=]() {
+        volatile unsigned int edc = build_edc(data, 16, 16 + 8 + 2048 - 1);
+        (void) edc;
+    });
+
+    /* The same, for each EDC implementation the CPU supports */
+    const struct {
+        const char* name;
+        edc_crc_impl_t impl;
+    } crcs[] = {
+        {"build_edc bytewise", EDC_CRC_BYTEWISE},
+        {"build_edc slice8", EDC_CRC_SLICE8},
+        {"build_edc slice16", EDC_CRC_SLICE16},
+        {"build_edc pclmul", EDC_CRC_PCLMUL},
+    };
+
+    for(auto& crc: crcs) {
+        if(edc_crc_select(crc.impl)) {
+            run(crc.name, 1, 2352, [=]() {
+                volatile unsigned int edc = build_edc(data, 16, 16 + 8 + 2048 - 1);
+                (void) edc;
+            });
+        }
+    }
+    edc_crc_select(EDC_CRC_AUTO);
+
+    /* P and Q parity, for each RSPC implementation the CPU supports */
+    const struct {
+        const char* name;
+        edc_rspc_impl_t impl;
+    } rspcs[] = {
+        {"", EDC_RSPC_AUTO},
+        {" table", EDC_RSPC_TABLE},
+        {" ssse3", EDC_RSPC_SSSE3},
+        {" avx2", EDC_RSPC_AVX2},
+        {" neon", EDC_RSPC_NEON},
+    };
+
+    for(auto& rspc: rspcs) {
+        if(!edc_rspc_select(rspc.impl)) {
+            continue;
+        }
+
+        run(std::string("encode_L2_P") + rspc.name, 1, 2352, [=]() {
+            encode_L2_P(data + 12);
+        });
+
+        run(std::string("encode_L2_Q") + rspc.name, 1, 2352, [=]() {
+            encode_L2_Q(data + 12);
+        });
+    }
+    edc_rspc_select(EDC_RSPC_AUTO);
+
+    const struct {
+        const char* name;
+        int type;
+    } types[] = {
+        {"do_encode_L2 MODE_0", MODE_0},
+        {"do_encode_L2 MODE_1", MODE_1},
+        {"do_encode_L2 MODE_2", MODE_2},
+        {"do_encode_L2 MODE_2_FORM_1", MODE_2_FORM_1},
+        {"do_encode_L2 MODE_2_FORM_2", MODE_2_FORM_2},
+    };
+
+    for(auto& type: types) {
+        int sector_type = type.type;
+        unsigned address = 150;
+        run(type.name, 1, 2352, [=, &address]() {
+            do_encode_L2(data, sector_type, address++);
+        });
+    }
+
+    /* The batch encoder, on a run of 64 sectors */
+    const size_t batch_sectors = 64;
+    std::vector<uint8_t> batch(batch_sectors * EDC_RAW_SECTOR_SIZE);
+    for(size_t i = 0; i < batch_sectors; ++i) {
+        auto raw = make_sector(i);
+        memcpy(&batch[i * EDC_RAW_SECTOR_SIZE], &raw[0], EDC_RAW_SECTOR_SIZE);
+    }
+
+    edc_ctx_t ctx;
+    edc_ctx_init(&ctx);
+    run("edc_encode_batch FORM_1", batch_sectors, 2352, [&]() {
+        edc_encode_batch(&ctx, &batch[0], batch_sectors, 150, MODE_2_FORM_1);
+    });
+
+    /* Padding, where all but the first sector reuse its parity */
+    std::vector<uint8_t> zeros(batch_sectors * EDC_RAW_SECTOR_SIZE);
+    for(size_t i = 0; i < batch_sectors; ++i) {
+        memcpy(&zeros[i * EDC_RAW_SECTOR_SIZE + 16], &batch[16], 8);
+    }
+
+    run("edc_encode_batch zeros", batch_sectors, 2352, [&]() {
+        edc_encode_batch(&ctx, &zeros[0], batch_sectors, 150, MODE_2_FORM_1);
+    });
+}
+
+static void bench_scramble() {
+    const struct {
+        const char* name;
+        size_t size;
+        unsigned int threads;
+    } sizes[] = {
+        {"scramble 16MB", 16 * 1024 * 1024, 1},
+        {"scramble 16MB 4 threads", 16 * 1024 * 1024, 4},
+        {"scramble 2MB", 2 * 1024 * 1024, 1},
+        {"scramble 512KB", 512 * 1024, 1},
+        {"scramble 32B", 32, 1},
+    };
+
+    /* Scrambled in place, so each run scrambles the last one's output again,
+     * which takes the same time */
+
+    for(auto& size: sizes) {
+        auto bytes = random_bytes(size.size, 2);
+        std::vector<char> input(bytes.begin(), bytes.end());
+        unsigned int threads = size.threads;
+        run(size.name, size.size / 2048.0, 2048, [&input, threads]() {
+            scramble(input, threads);
+        });
+    }
+
+    auto bytes = random_bytes(16 * 1024 * 1024, 2);
+    std::vector<char> input(bytes.begin(), bytes.end());
+    run("descramble 16MB", input.size() / 2048.0, 2048, [&input]() {
+        descramble(input);
+    });
+}
+
+/* An SH4 executable with one 1MB PT_LOAD segment and some .bss */
+static std::vector<char> make_elf(size_t text_size, size_t bss_size) {
+    const uint32_t base = 0x8c010000;
+    const char shstrtab[] = "\0.text\0.bss\0.shstrtab";
+    const size_t text_offset = 0x1000;
+    const size_t shstrtab_offset = text_offset + text_size;
+    const size_t shdr_offset = (shstrtab_offset + sizeof(shstrtab) + 3) & ~3;
+
+    std::vector<char> elf(shdr_offset + 4 * sizeof(Elf32_Shdr));
+
+    Elf32_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, "\x7f" "ELF\x01\x01\x01", 7);
+    ehdr.e_type = 2;
+    ehdr.e_machine = 42; /* SH */
+    ehdr.e_version = 1;
+    ehdr.e_entry = base;
+    ehdr.e_phoff = sizeof(Elf32_Ehdr);
+    ehdr.e_shoff = shdr_offset;
+    ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf32_Phdr);
+    ehdr.e_phnum = 1;
+    ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    ehdr.e_shnum = 4;
+    ehdr.e_shstrndx = 3;
+    memcpy(&elf[0], &ehdr, sizeof(ehdr));
+
+    Elf32_Phdr phdr;
+    memset(&phdr, 0, sizeof(phdr));
+    phdr.p_type = 1; /* PT_LOAD */
+    phdr.p_offset = text_offset;
+    phdr.p_vaddr = base;
+    phdr.p_paddr = base;
+    phdr.p_filesz = text_size;
+    phdr.p_memsz = text_size + bss_size;
+    phdr.p_flags = 7;
+    phdr.p_align = 0x1000;
+    memcpy(&elf[sizeof(ehdr)], &phdr, sizeof(phdr));
+
+    auto text = random_bytes(text_size, 3);
+    memcpy(&elf[text_offset], &text[0], text_size);
+    memcpy(&elf[shstrtab_offset], shstrtab, sizeof(shstrtab));
+
+    Elf32_Shdr shdrs[4];
+    memset(shdrs, 0, sizeof(shdrs));
+    shdrs[1] = {1, 1, 6, base, uint32_t(text_offset), uint32_t(text_size), 0, 0, 4, 0};
+    shdrs[2] = {7, 8, 3, uint32_t(base + text_size), uint32_t(shstrtab_offset), uint32_t(bss_size), 0, 0, 4, 0};
+    shdrs[3] = {12, 3, 0, 0, uint32_t(shstrtab_offset), sizeof(shstrtab), 0, 0, 1, 0};
+    memcpy(&elf[shdr_offset], shdrs, sizeof(shdrs));
+
+    return elf;
+}
+
+static void bench_elf() {
+    const size_t text_size = 1024 * 1024;
+    auto elf = make_elf(text_size, 256 * 1024);
+
+    /* The parser reports what it did on std::cout, which would drown the results */
+    run("ELF Load + fill_bin", text_size / 2048.0, 2048, [&elf]() {
+        auto buffer = std::cout.rdbuf(nullptr);
+        auto flags = std::cout.flags();
+
+        auto parser = elfparser::Parser::Load(elf);
+        std::vector<char> bin;
+        parser.value()->fill_bin(bin);
+
+        std::cout.flags(flags);
+        std::cout.rdbuf(buffer);
+    });
+}
+
+static void bench_wav() {
+    const uint32_t length = 10 * 44100 * 4; /* 10 seconds */
+    auto path = std::filesystem::temp_directory_path() / "mkdcdisc-microbench.wav";
+
+    {
+        struct {
+            char riff[4];
+            uint32_t riff_length;
+            char wave[4];
+            char fmt[4];
+            uint32_t fmt_length;
+            uint16_t type;
+            uint16_t channels;
+            uint32_t frequency;
+            uint32_t rate;
+            uint16_t bytes_per_sample;
+            uint16_t bitrate;
+            char data[4];
+            uint32_t data_length;
+        } header = {
+            {'R', 'I', 'F', 'F'}, 36 + length, {'W', 'A', 'V', 'E'},
+            {'f', 'm', 't', ' '}, 16, 1, 2, 44100, 44100 * 4, 4, 16,
+            {'d', 'a', 't', 'a'}, length
+        };
+
+        auto samples = random_bytes(length, 4);
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char*) &header, sizeof(header));
+        out.write((const char*) &samples[0], length);
+    }
+
+    std::vector<uint8_t> samples(length);
+    std::string filename = path.string();
+    run("wav find + read", length / 2048.0, 2048, [&]() {
+        auto wav = find_wav_data(filename, false);
+        read_wav_data(filename, wav.value(), &samples[0]);
+    });
+
+    std::filesystem::remove(path);
+}
+
+int main(int argc, char* argv[]) {
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--filter" && i + 1 < argc) {
+            OPTIONS.filter = argv[++i];
+        } else if(arg == "--min-time" && i + 1 < argc) {
+            OPTIONS.min_time = std::stod(argv[++i]);
+        } else if(arg == "--perf") {
+            OPTIONS.perf = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--filter TEXT] [--min-time SECONDS] [--perf]" << std::endl;
+            return (arg == "--help" || arg == "-h") ? 0 : 1;
+        }
+    }
+
+    if(OPTIONS.perf) {
+        PERF_AVAILABLE = PERF.open();
+        if(!PERF_AVAILABLE) {
+            std::cerr << "Hardware counters are unavailable, check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+        }
+    }
+
+    std::cout << std::left << std::setw(28) << "kernel" << std::right
+              << std::setw(12) << "ns/sector" << std::setw(10) << "GB/s";
+    if(PERF_AVAILABLE) {
+        std::cout << std::setw(14) << "cycles/sector" << std::setw(8) << "IPC" << std::setw(16) << "misses/sector";
+    }
+    std::cout << std::endl;
+
+    bench_edc_ecc();
+    bench_scramble();
+    bench_elf();
+    bench_wav();
+
+    return 0;
+}
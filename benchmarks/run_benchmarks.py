@@ -0,0 +1,271 @@
+#!/usr/bin/env python3
+
+# End-to-end benchmarks for mkdcdisc. Each scenario builds a complete image
+# from synthetic inputs and reports the wall time, output MB/s and the peak
+# RSS of the mkdcdisc process.
+#
+# Inputs are generated once into <work-dir>/inputs and reused by later runs.
+# They are deterministic, so numbers from different machines are comparable.
+#
+# Usage:
+#   run_benchmarks.py --mkdcdisc builddir/mkdcdisc --work-dir /tmp/bench [--scenario NAME]...
+#
+# The meson benchmark target runs each scenario as its own benchmark:
+#   meson test -C builddir --benchmark
+
+import argparse
+import os
+import random
+import struct
+import subprocess
+import sys
+import time
+
+MB = 1024 * 1024
+
+DC_RAM_START_ADDR = 0x8C010000
+EM_SH = 42
+
+
+def write_elf(path, text_size, bss_size, seed):
+    """A minimal SH4 ELF: one PT_LOAD segment (.text + .data) followed by .bss"""
+    rng = random.Random(seed)
+    text = rng.randbytes(text_size)
+    data = rng.randbytes(4096)
+    shstrtab = b"\0.text\0.data\0.bss\0.shstrtab\0"
+
+    ehdr_size, phdr_size, shdr_size = 52, 32, 40
+    text_offset = 0x1000
+    data_offset = text_offset + len(text)
+    shstrtab_offset = data_offset + len(data)
+    shdr_offset = (shstrtab_offset + len(shstrtab) + 3) & ~3
+    file_size = len(text) + len(data)
+
+    ehdr = b"\x7fELF" + bytes([1, 1, 1, 0]) + bytes(8)
+    ehdr += struct.pack("<HHIIIIIHHHHHH", 2, EM_SH, 1, DC_RAM_START_ADDR, ehdr_size, shdr_offset,
+                        0, ehdr_size, phdr_size, 1, shdr_size, 5, 4)
+    phdr = struct.pack("<IIIIIIII", 1, text_offset, DC_RAM_START_ADDR, DC_RAM_START_ADDR,
+                       file_size, file_size + bss_size, 7, 0x1000)
+
+    shdrs = bytes(shdr_size)
+    shdrs += struct.pack("<IIIIIIIIII", 1, 1, 6, DC_RAM_START_ADDR, text_offset, len(text), 0, 0, 4, 0)
+    shdrs += struct.pack("<IIIIIIIIII", 7, 1, 3, DC_RAM_START_ADDR + len(text), data_offset, len(data), 0, 0, 4, 0)
+    shdrs += struct.pack("<IIIIIIIIII", 13, 8, 3, DC_RAM_START_ADDR + file_size, shstrtab_offset, bss_size, 0, 0, 4, 0)
+    shdrs += struct.pack("<IIIIIIIIII", 18, 3, 0, 0, shstrtab_offset, len(shstrtab), 0, 0, 1, 0)
+
+    out = bytearray(ehdr + phdr)
+    out += bytes(text_offset - len(out))
+    out += text + data + shstrtab
+    out += bytes(shdr_offset - len(out))
+    out += shdrs
+
+    with open(path, "wb") as f:
+        f.write(out)
+
+
+def write_wav(path, seconds, seed):
+    """Stereo, 44100Hz, 16 bit samples"""
+    rng = random.Random(seed)
+    length = seconds * 44100 * 4
+
+    with open(path, "wb") as f:
+        f.write(b"RIFF" + struct.pack("<I", 36 + length) + b"WAVE")
+        f.write(b"fmt " + struct.pack("<IHHIIHH", 16, 1, 2, 44100, 44100 * 4, 4, 16))
+        f.write(b"data" + struct.pack("<I", length))
+        for _ in range(length // MB):
+            f.write(rng.randbytes(MB))
+        f.write(rng.randbytes(length % MB))
+
+
+def write_random_file(path, size, seed):
+    rng = random.Random(seed)
+    with open(path, "wb") as f:
+        for _ in range(size // MB):
+            f.write(rng.randbytes(MB))
+        f.write(rng.randbytes(size % MB))
+
+
+CDDA_TRACKS = 10
+
+
+def generate_small_elf(path):
+    write_elf(path, 64 * 1024, 16 * 1024, 1)
+
+
+def generate_large_elf(path):
+    write_elf(path, 8 * MB, 1 * MB, 2)
+
+
+def generate_many_files(path):
+    rng = random.Random(3)
+    for i in range(10000):
+        directory = os.path.join(path, "dir%03d" % (i // 100))
+        os.makedirs(directory, exist_ok=True)
+        with open(os.path.join(directory, "file%05d.dat" % i), "wb") as f:
+            f.write(rng.randbytes(rng.randint(512, 4096)))
+
+
+def generate_large_assets(path):
+    os.makedirs(path, exist_ok=True)
+    for i in range(3):
+        write_random_file(os.path.join(path, "asset%d.bin" % i), 200 * MB, 10 + i)
+
+
+def generate_cdda(path):
+    os.makedirs(path, exist_ok=True)
+    for i in range(CDDA_TRACKS):
+        write_wav(os.path.join(path, "track%02d.wav" % (i + 1)), 30, 20 + i)
+
+
+# Input name -> function creating it at the given path
+INPUTS = {
+    "small.elf": generate_small_elf,
+    "large.elf": generate_large_elf,
+    "many_files": generate_many_files,
+    "large_assets": generate_large_assets,
+    "cdda": generate_cdda,
+}
+
+# Scenario name -> the inputs it needs
+SCENARIO_INPUTS = {
+    "small_elf": ["small.elf"],
+    "large_elf": ["large.elf"],
+    "many_files": ["small.elf", "many_files"],
+    "large_assets": ["small.elf", "large_assets"],
+    "cdda_tracks": ["small.elf", "cdda"],
+    "no_padding": ["small.elf"],
+}
+
+
+def generate_inputs(inputs, names):
+    """Creates the named inputs that are missing from the inputs directory.
+    Each one is built under a temporary name first, so an interrupted run
+    doesn't leave a partial input behind"""
+    os.makedirs(inputs, exist_ok=True)
+
+    for name in names:
+        path = os.path.join(inputs, name)
+        if os.path.exists(path):
+            continue
+
+        staging = path + ".tmp"
+        INPUTS[name](staging)
+        os.rename(staging, path)
+
+
+def scenarios(inputs):
+    """Name -> mkdcdisc arguments (other than the output)"""
+    small_elf = ["-e", os.path.join(inputs, "small.elf")]
+    cdda = ["track%02d.wav" % (i + 1) for i in range(CDDA_TRACKS)]
+
+    return {
+        "small_elf": small_elf,
+        "large_elf": ["-e", os.path.join(inputs, "large.elf")],
+        "many_files": small_elf + ["-d", os.path.join(inputs, "many_files")],
+        "large_assets": small_elf + ["-d", os.path.join(inputs, "large_assets")],
+        "cdda_tracks": small_elf + [arg for name in cdda for arg in ("-c", os.path.join(inputs, "cdda", name))],
+        "no_padding": small_elf + ["-N"],
+    }
+
+
+def read_peak_rss(pid):
+    """VmHWM of a running process on Linux, in bytes"""
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1]) * 1024
+    except OSError:
+        pass
+    return None
+
+
+def run_mkdcdisc(command):
+    """Returns (exit code, wall time, peak RSS in bytes or None)
+
+    The rusage of a child also counts the memory it had between fork() and
+    exec(), i.e. the memory of this script. On Linux the child's own high
+    water mark is polled instead. Runs too short to be sampled report None."""
+    start = time.perf_counter()
+    process = subprocess.Popen(command, stdout=subprocess.DEVNULL)
+
+    if sys.platform.startswith("linux"):
+        # The first sample may be taken before exec() or straight after it
+        samples = []
+        while process.poll() is None:
+            sample = read_peak_rss(process.pid)
+            if sample is not None:
+                samples.append(sample)
+            time.sleep(0.005)
+        wall = time.perf_counter() - start
+        peak_rss = max(samples[1:]) if len(samples) > 1 else None
+        return process.returncode, wall, peak_rss
+
+    if hasattr(os, "wait4"):
+        _, status, usage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+        process.returncode = os.waitstatus_to_exitcode(status)
+
+        # ru_maxrss is in bytes on macOS and kB everywhere else
+        peak_rss = usage.ru_maxrss if sys.platform == "darwin" else usage.ru_maxrss * 1024
+        return process.returncode, wall, peak_rss
+
+    process.wait()
+    return process.returncode, time.perf_counter() - start, None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Time complete mkdcdisc image builds")
+    parser.add_argument("--mkdcdisc", required=True, help="path to the mkdcdisc executable")
+    parser.add_argument("--work-dir", required=True, help="where inputs are cached and images are written")
+    parser.add_argument("--scenario", action="append", help="scenario to run, repeat for several (default: all)")
+    parser.add_argument("--repeat", type=int, default=1, help="runs per scenario, the fastest is reported")
+    parser.add_argument("--keep", action="store_true", help="keep the generated images")
+    args = parser.parse_args()
+
+    inputs = os.path.join(args.work_dir, "inputs")
+    outputs = os.path.join(args.work_dir, "outputs")
+    os.makedirs(outputs, exist_ok=True)
+
+    available = scenarios(inputs)
+    selected = args.scenario or list(available)
+    for name in selected:
+        if name not in available:
+            parser.error("unknown scenario %s, expected one of: %s" % (name, ", ".join(available)))
+
+    generate_inputs(inputs, sorted({needed for name in selected for needed in SCENARIO_INPUTS[name]}))
+
+    print("%-14s %10s %10s %10s %12s" % ("scenario", "wall (s)", "MB", "MB/s", "peak RSS MB"))
+
+    failed = False
+    for name in selected:
+        output = os.path.join(outputs, name + ".cdi")
+        command = [args.mkdcdisc, "-q", "-o", output] + available[name]
+
+        best = None
+        for _ in range(args.repeat):
+            code, wall, peak_rss = run_mkdcdisc(command)
+            if code != 0:
+                print("%-14s failed with exit code %d" % (name, code))
+                failed = True
+                break
+
+            if best is None or wall < best[0]:
+                best = (wall, peak_rss)
+
+        if best is None:
+            continue
+
+        wall, peak_rss = best
+        size = os.path.getsize(output) / MB
+        rss = "%.1f" % (peak_rss / MB) if peak_rss is not None else "n/a"
+        print("%-14s %10.2f %10.1f %10.1f %12s" % (name, wall, size, size / wall, rss))
+
+        if not args.keep:
+            os.remove(output)
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,19 +1,144 @@
+/* clock_gettime() isn't part of C99 */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 #include "disc_image.h"
 #include "private.h"
 #include "edc/ecc.h"
 #include "edc/libedc.h"
 
 
-static void write_cdda_pregap(FILE* output, size_t sectors) {
-    uint8_t pregap_sector[2352] = {0};
-    for(int i = 0; i < sectors; ++i) {
-        fwrite(pregap_sector, sizeof(pregap_sector), 1, output);
+/* Running totals while an image is written, reported to the trace hook and
+ * the progress callback */
+typedef struct {
+    const cd_image_t* image;
+    edc_ctx_t edc;
+    image_output_t output;
+    uint64_t sectors_written;
+    uint64_t bytes_written;
+
+    cd_progress_t progress;
+    double start_time;
+    double last_report_time;
+    uint64_t last_report_bytes;
+} cdi_writer_t;
+
+static double monotonic_seconds() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static void report_progress(cdi_writer_t* writer) {
+    const cd_image_t* image = writer->image;
+    if(!image->progress_fn) {
+        return;
+    }
+
+    double now = monotonic_seconds();
+    double since_last = now - writer->last_report_time;
+
+    cd_progress_t* progress = &writer->progress;
+    progress->sectors_written = writer->sectors_written;
+    progress->bytes_written = writer->bytes_written;
+    progress->elapsed_seconds = now - writer->start_time;
+
+    if(progress->elapsed_seconds > 0) {
+        progress->mb_per_second = (writer->bytes_written / 1e6) / progress->elapsed_seconds;
+    }
+
+    if(since_last > 0) {
+        progress->current_mb_per_second = ((writer->bytes_written - writer->last_report_bytes) / 1e6) / since_last;
+    }
+
+    writer->last_report_time = now;
+    writer->last_report_bytes = writer->bytes_written;
+
+    image->progress_fn(image->progress_user_data, progress);
+}
+
+/* The number of sectors write_track_*() stores for a track */
+static size_t stored_track_sectors(const cd_track_t* track) {
+    size_t sectors = cd_track_total_size_in_sectors(track);
+
+    switch(cd_track_mode(track)) {
+    case TRACK_MODE_CDDA: {
+        /* Audio tracks are padded out to at least 302 sectors after the pregap */
+        size_t after_pregap = sectors - track->pregap_sectors;
+        return (after_pregap < 302) ? track->pregap_sectors + 302 : sectors;
+    }
+    default:
+        return sectors;
+    }
+}
+
+/* Mode 2 sectors are stored from the subheader on, which is the same size
+ * for either form: 8 + 2048 + 4 + 276 or 8 + 2324 + 4 */
+#define MODE2_STORED_SECTOR_SIZE 2336
+
+/* The size of each sector write_track_*() stores for a track */
+static size_t stored_sector_size(const cd_track_t* track) {
+    switch(cd_track_mode(track)) {
+    case TRACK_MODE_CDDA:
+        return 2352;
+    case TRACK_MODE_MODE1:
+        return 2048;
+    default:
+        return MODE2_STORED_SECTOR_SIZE;
     }
 }
 
-static void write_mode2_pregap(FILE* output, size_t sectors) {
+static void write_output(cdi_writer_t* writer, const void* data, size_t len) {
+    output_write(&writer->output, data, len);
+    writer->bytes_written += len;
+}
+
+static void write_repeated(cdi_writer_t* writer, const void* sector, size_t len, size_t count) {
+    output_repeat(&writer->output, sector, len, count);
+    writer->bytes_written += len * count;
+}
+
+static void count_sectors(cdi_writer_t* writer, size_t sectors) {
+    if(!sectors) {
+        return;
+    }
+
+    writer->sectors_written += sectors;
+    image_trace(writer->image, CD_TRACE_COUNTER, "sectors_written", writer->sectors_written);
+    image_trace(writer->image, CD_TRACE_COUNTER, "bytes_written", writer->bytes_written);
+    report_progress(writer);
+}
+
+/* Gaps in tracks which only store user data are all zeros */
+static void write_zero_gap(cdi_writer_t* writer, size_t sector_size, size_t sectors) {
+    uint8_t gap_sector[2352] = {0};
+    write_repeated(writer, gap_sector, sector_size, sectors);
+    count_sectors(writer, sectors);
+}
+
+static void write_cdda_pregap(cdi_writer_t* writer, size_t sectors) {
+    write_zero_gap(writer, 2352, sectors);
+}
+
+static void write_mode2_pregap(cdi_writer_t* writer, size_t sectors) {
     const uint8_t pregap_header[] = {
         0x00, 0x00, 0x20, 0x00,
         0x00, 0x00, 0x20, 0x00
@@ -31,78 +156,417 @@ static void write_mode2_pregap(FILE* output, size_t sectors) {
         sizeof(pregap_edc)
     );
 
-    for(int i = 0; i < sectors; ++i) {
-        fwrite(pregap_sector, sizeof(pregap_sector), 1, output);
-    }
+    write_repeated(writer, pregap_sector, sizeof(pregap_sector), sectors);
+    count_sectors(writer, sectors);
 }
 
-static void write_track_cdda(const cd_track_t* track, FILE* output) {        
-    write_cdda_pregap(output, track->pregap_sectors);
+/* Writes the track's data as it is, sector_size bytes per sector, with the
+ * final sector zero padded */
+static void write_user_data(cdi_writer_t* writer, const cd_track_t* track, size_t sector_size) {
+    uint8_t null_sector[2352] = {0};
+
+    const size_t data_len = cd_track_data_size_in_bytes(track);
+    const size_t batch_size = writer->image->batch_sectors * sector_size;
+    uint8_t* batch = malloc(batch_size);
+    for(size_t offset = 0; offset < data_len; offset += batch_size) {
+        size_t len = data_len - offset;
+        if(len > batch_size) {
+            len = batch_size;
+        }
 
-    size_t sectors_written = 0;
+        image_trace(writer->image, CD_TRACE_BEGIN, "read_source", 0);
+        const uint8_t* data = track_source_read(track->source, offset, batch, len);
+        image_trace(writer->image, CD_TRACE_END, "read_source", 0);
 
-    uint8_t null_sector[2352] = {0};
-    fwrite(track->data, track->data_len, 1, output);  /* Write the data raw */
+        image_trace(writer->image, CD_TRACE_BEGIN, "write", 0);
+        write_output(writer, data, len);
 
-    /* Pad until the end of the sector */
-    size_t remainder = (track->data_len % 2352);
-    if(remainder) {
-        size_t padding = 2352 - remainder;
-        fwrite(null_sector, padding, 1, output);
+        /* Pad until the end of the sector */
+        size_t remainder = (len % sector_size);
+        if(remainder) {
+            write_output(writer, null_sector, sector_size - remainder);
+        }
+        image_trace(writer->image, CD_TRACE_END, "write", 0);
+
+        count_sectors(writer, (len + sector_size - 1) / sector_size);
     }
+    free(batch);
+}
 
+static void write_track_cdda(cdi_writer_t* writer, const cd_track_t* track) {
+    write_cdda_pregap(writer, track->pregap_sectors);
+
+    size_t sectors_written = 0;
+
+    /* Write the data raw */
+    write_user_data(writer, track, 2352);
     sectors_written += cd_track_data_size_in_sectors(track);
 
-    write_cdda_pregap(output, track->postgap_sectors);
+    write_cdda_pregap(writer, track->postgap_sectors);
     sectors_written += track->postgap_sectors;
 
     if(sectors_written < 302) {
-        write_cdda_pregap(output, 302 - sectors_written);
+        write_cdda_pregap(writer, 302 - sectors_written);
     }
 }
 
-static void write_track_xa_mode2_form1(const cd_track_t* track, FILE* output) {
-    size_t sectors_written = track->pregap_sectors;
-    write_mode2_pregap(output, sectors_written);
+/* Mode 1 tracks are stored as just their user data, and formless Mode 2
+ * tracks as their 2336 bytes, so there's nothing to encode */
+static void write_track_plain(cdi_writer_t* writer, const cd_track_t* track) {
+    const size_t sector_size = stored_sector_size(track);
 
-    const uint8_t SUBHEADER[8] = {
-        0x00, 0x00, 0x09, 0x00,  /* Data subheader, duplicated */
-        0x00, 0x00, 0x09, 0x00
-    };
+    write_zero_gap(writer, sector_size, track->pregap_sectors);
+    write_user_data(writer, track, sector_size);
+    write_zero_gap(writer, sector_size, track->postgap_sectors);
+}
+
+/* Per sector changes from a track's sector hook */
+typedef struct {
+    uint8_t subheader[4];
+    bool replaced;          /* The payload came from the hook, not the source */
+} sector_info_t;
+
+/* One batch of an XA Mode 2 track, from source data to the sectors the CDI
+ * stores (from the subheader on) */
+typedef struct {
+    const cd_track_t* track;
+    size_t payload_size;    /* Source bytes per sector, 2048 or 2324 */
+
+    uint8_t* buffer;        /* Source data is read into here if it isn't in memory */
+    const uint8_t* data;
+    size_t len;
+    uint8_t* out;           /* Room for batch_sectors raw sectors */
+    size_t count;
+    size_t start_lba;
+    int state;
+
+    /* Only allocated if the track has a sector hook. payloads holds 2324
+     * bytes per sector */
+    sector_info_t* sectors;
+    uint8_t* payloads;
+
+    /* Where the encoding thread writes the batch, or -1 if it's left to
+     * the writer */
+    int64_t file_offset;
+    bool write_failed;
+} data_batch_t;
+
+enum {
+    DATA_BATCH_EMPTY,
+    DATA_BATCH_READ,
+    DATA_BATCH_ENCODED
+};
+
+static bool is_form2_track(const cd_track_t* track) {
+    return cd_track_mode(track) == TRACK_MODE_XA_MODE2_FORM2;
+}
+
+static void default_subheader(const cd_track_t* track, uint8_t subheader[4]) {
+    subheader[0] = 0x00;
+    subheader[1] = 0x00;
+    subheader[2] = CD_SUBMODE_DATA | CD_SUBMODE_EOR;
+    subheader[3] = 0x00;
+
+    if(is_form2_track(track)) {
+        subheader[2] |= CD_SUBMODE_FORM2;
+    }
+}
 
-    uint8_t sector_with_sync[12 + 4 + 8 + 2048 + 4 + 276];
-    uint8_t* sector = sector_with_sync + 12;
-    uint8_t* sector_subheader = sector + 4;
-    uint8_t* user_data = sector + 4 + 8;
+/* Whether a raw sector's subheader makes it Form 2 */
+static bool is_form2_sector(const uint8_t* raw) {
+    return (raw[16 + 2] & CD_SUBMODE_FORM2) != 0;
+}
 
-    memcpy(sector_subheader, SUBHEADER, sizeof(SUBHEADER));
+/* Sectors are filled in place as raw sectors and encoded in runs of the
+ * same form, then packed down */
+static void encode_data_batch(const cdi_writer_t* writer, data_batch_t* batch) {
+    const size_t payload_size = batch->payload_size;
+
+    uint8_t track_subheader[4];
+    default_subheader(batch->track, track_subheader);
+
+    image_trace(writer->image, CD_TRACE_BEGIN, "encode", 0);
+    batch->count = (batch->len + payload_size - 1) / payload_size;
+    for(size_t i = 0; i < batch->count; ++i) {
+        uint8_t* raw = batch->out + i * EDC_RAW_SECTOR_SIZE;
+        const uint8_t* subheader = track_subheader;
+        const uint8_t* data = batch->data + i * payload_size;
+
+        /* The final sector is zero padded */
+        size_t n = (batch->len - i * payload_size < payload_size) ? batch->len - i * payload_size : payload_size;
+        if(batch->sectors) {
+            subheader = batch->sectors[i].subheader;
+            if(batch->sectors[i].replaced) {
+                data = batch->payloads + i * 2324;
+                n = 2324;
+            }
+        }
 
-    size_t bytes_written = 0;
-    for(size_t i = 0; i < track->data_len; i += 2048) {
-        memcpy(user_data, track->data + i, 2048);
+        const size_t sector_size = (subheader[2] & CD_SUBMODE_FORM2) ? 2324 : 2048;
+        if(n > sector_size) {
+            n = sector_size;
+        }
 
-        do_encode_L2(sector_with_sync, MODE_2_FORM_1, sectors_written);
+        memcpy(raw + 16, subheader, 4);
+        memcpy(raw + 20, subheader, 4);
+        memcpy(raw + 24, data, n);
+        memset(raw + 24 + n, 0, sector_size - n);
+    }
+
+    for(size_t first = 0; first < batch->count;) {
+        const bool form2 = is_form2_sector(batch->out + first * EDC_RAW_SECTOR_SIZE);
+        size_t end = first + 1;
+        while(end < batch->count && is_form2_sector(batch->out + end * EDC_RAW_SECTOR_SIZE) == form2) {
+            ++end;
+        }
 
-        fwrite(sector_subheader, 1, 8 + 2048 + 4 + 276, output);
-        bytes_written += 2048;
-        sectors_written++;
+        edc_encode_batch(&writer->edc, batch->out + first * EDC_RAW_SECTOR_SIZE, end - first,
+                         batch->start_lba + first, (form2) ? MODE_2_FORM_2 : MODE_2_FORM_1);
+        first = end;
     }
 
-    size_t remaining = track->data_len - bytes_written;
-    if(remaining) {
-        memset(user_data, 0, 2048);
-        memcpy(user_data, track->data + bytes_written, remaining);
-        do_encode_L2(sector_with_sync, MODE_2_FORM_1, sectors_written);
-        fwrite(sector_subheader, 1, 8 + 2048 + 4 + 276, output);
-        sectors_written++;
+    for(size_t i = 0; i < batch->count; ++i) {
+        memmove(batch->out + i * MODE2_STORED_SECTOR_SIZE, batch->out + i * EDC_RAW_SECTOR_SIZE + 16, MODE2_STORED_SECTOR_SIZE);
     }
+    image_trace(writer->image, CD_TRACE_END, "encode", 0);
+}
 
-    /* Write the post-gap */
-    write_mode2_pregap(output, track->postgap_sectors);
+/* Passes each sector of the batch to the track's sector hook */
+static void apply_sector_hook(const cd_track_t* track, size_t first_sector, data_batch_t* batch) {
+    const size_t payload_size = batch->payload_size;
+    const size_t count = (batch->len + payload_size - 1) / payload_size;
+
+    for(size_t i = 0; i < count; ++i) {
+        const uint8_t* data = batch->data + i * payload_size;
+
+        /* The hook always sees a whole sector */
+        uint8_t last[2324];
+        if(batch->len - i * payload_size < payload_size) {
+            size_t n = batch->len - i * payload_size;
+            memcpy(last, data, n);
+            memset(last + n, 0, payload_size - n);
+            data = last;
+        }
+
+        sector_info_t* info = &batch->sectors[i];
+        default_subheader(track, info->subheader);
+        info->replaced = track->sector_fn(track->sector_user_data, first_sector + i, data, info->subheader, batch->payloads + i * 2324);
+    }
+}
+
+static void read_data_batch(cdi_writer_t* writer, const cd_track_t* track, size_t offset, size_t start_lba, data_batch_t* batch) {
+    const size_t batch_size = writer->image->batch_sectors * batch->payload_size;
+    size_t len = cd_track_data_size_in_bytes(track) - offset;
+
+    batch->len = (len > batch_size) ? batch_size : len;
+    batch->start_lba = start_lba;
+
+    image_trace(writer->image, CD_TRACE_BEGIN, "read_source", 0);
+    batch->data = track_source_read(track->source, offset, batch->buffer, batch->len);
+    if(batch->sectors) {
+        apply_sector_hook(track, offset / batch->payload_size, batch);
+    }
+    image_trace(writer->image, CD_TRACE_END, "read_source", 0);
+}
+
+/* Encodes the batch, and writes it straight to its place in the file if it
+ * has one */
+static void encode_and_place_data_batch(const cdi_writer_t* writer, data_batch_t* batch) {
+    encode_data_batch(writer, batch);
+
+    if(batch->file_offset >= 0) {
+        image_trace(writer->image, CD_TRACE_BEGIN, "write", 0);
+        batch->write_failed = !output_write_at(&writer->output, batch->file_offset, batch->out, batch->count * MODE2_STORED_SECTOR_SIZE);
+        image_trace(writer->image, CD_TRACE_END, "write", 0);
+    }
+}
+
+static void write_data_batch(cdi_writer_t* writer, data_batch_t* batch) {
+    const size_t len = batch->count * MODE2_STORED_SECTOR_SIZE;
+
+    if(batch->file_offset >= 0) {
+        writer->bytes_written += len;
+        writer->output.failed |= batch->write_failed;
+    } else {
+        image_trace(writer->image, CD_TRACE_BEGIN, "write", 0);
+        write_output(writer, batch->out, len);
+        image_trace(writer->image, CD_TRACE_END, "write", 0);
+    }
+
+    count_sectors(writer, batch->count);
+}
+
+/* Worker threads encode batches in the order they were read. Where the
+ * output allows it they also write them, each to its own place in the
+ * file; otherwise the thread writing the image writes them out in order.
+ * Either way that thread reads the batches and counts them as written in
+ * order. */
+typedef struct {
+    const cdi_writer_t* writer;
+    data_batch_t* batches;
+    size_t batch_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    size_t batches_read;
+    size_t next_to_encode;
+    bool finished;
+} data_pool_t;
+
+static void* data_worker(void* arg) {
+    data_pool_t* pool = (data_pool_t*) arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for(;;) {
+        while(!pool->finished && pool->next_to_encode == pool->batches_read) {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+
+        if(pool->next_to_encode == pool->batches_read) {
+            break;
+        }
+
+        data_batch_t* batch = &pool->batches[pool->next_to_encode++ % pool->batch_count];
+        pthread_mutex_unlock(&pool->lock);
+
+        encode_and_place_data_batch(pool->writer, batch);
+
+        pthread_mutex_lock(&pool->lock);
+        batch->state = DATA_BATCH_ENCODED;
+        pthread_cond_broadcast(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void write_data_batches_threaded(cdi_writer_t* writer, const cd_track_t* track, data_batch_t* batches, size_t batch_count, pthread_t* threads, size_t thread_count) {
+    const size_t batch_size = writer->image->batch_sectors * batches[0].payload_size;
+    const size_t data_len = cd_track_data_size_in_bytes(track);
+    const size_t total = (data_len + batch_size - 1) / batch_size;
+
+    data_pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.writer = writer;
+    pool.batches = batches;
+    pool.batch_count = batch_count;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+
+    size_t started = 0;
+    for(; started < thread_count; ++started) {
+        if(pthread_create(&threads[started], NULL, data_worker, &pool) != 0) {
+            break;
+        }
+    }
+
+    /* Batches are a fixed size, so each one's offset is known up front */
+    const size_t stored_batch_size = writer->image->batch_sectors * MODE2_STORED_SECTOR_SIZE;
+    int64_t data_offset = -1;
+    if(output_can_write_at(&writer->output)) {
+        data_offset = output_skip(&writer->output, (uint64_t) cd_track_data_size_in_sectors(track) * MODE2_STORED_SECTOR_SIZE);
+    }
+
+    size_t read = 0;
+    size_t written = 0;
+    size_t start_lba = track->pregap_sectors;
+    while(written < total) {
+        /* Keep every batch busy, and only wait for the next one to write
+         * when there's nothing left to read */
+        if(read < total && read - written < batch_count) {
+            data_batch_t* batch = &batches[read % batch_count];
+            read_data_batch(writer, track, read * batch_size, start_lba, batch);
+            start_lba += (batch->len + batch->payload_size - 1) / batch->payload_size;
+            batch->file_offset = (data_offset >= 0) ? data_offset + (int64_t) (read * stored_batch_size) : -1;
+
+            /* No threads could be started, so encode here instead */
+            if(!started) {
+                encode_and_place_data_batch(writer, batch);
+            }
+
+            pthread_mutex_lock(&pool.lock);
+            batch->state = (started) ? DATA_BATCH_READ : DATA_BATCH_ENCODED;
+            pool.batches_read = ++read;
+            pthread_cond_broadcast(&pool.changed);
+            pthread_mutex_unlock(&pool.lock);
+            continue;
+        }
+
+        data_batch_t* batch = &batches[written % batch_count];
+        pthread_mutex_lock(&pool.lock);
+        while(batch->state != DATA_BATCH_ENCODED) {
+            pthread_cond_wait(&pool.changed, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        write_data_batch(writer, batch);
+        batch->state = DATA_BATCH_EMPTY;
+        ++written;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.finished = true;
+    pthread_cond_broadcast(&pool.changed);
+    pthread_mutex_unlock(&pool.lock);
+
+    for(size_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool.changed);
+    pthread_mutex_destroy(&pool.lock);
 }
 
-static void write_track_xa_mode2_form2(const cd_track_t* track, FILE* output) {
+/* Form 1 and Form 2 tracks only differ in how much source data goes in each
+ * sector, and which form sectors are unless a sector hook says otherwise */
+static void write_track_xa_mode2(cdi_writer_t* writer, const cd_track_t* track) {
+    write_mode2_pregap(writer, track->pregap_sectors);
+
+    /* Each thread gets two batches, so one can be read or written while
+     * the other is encoded */
+    const size_t thread_count = (writer->image->threads > 1) ? writer->image->threads : 0;
+    const size_t batch_count = (thread_count) ? thread_count * 2 : 1;
+    const size_t batch_sectors = writer->image->batch_sectors;
+    const size_t payload_size = is_form2_track(track) ? 2324 : 2048;
+
+    data_batch_t* batches = calloc(batch_count, sizeof(data_batch_t));
+    for(size_t i = 0; i < batch_count; ++i) {
+        batches[i].track = track;
+        batches[i].payload_size = payload_size;
+        batches[i].buffer = malloc(batch_sectors * payload_size);
+        batches[i].out = malloc(batch_sectors * EDC_RAW_SECTOR_SIZE);
+        batches[i].file_offset = -1;
+
+        if(track->sector_fn) {
+            batches[i].sectors = malloc(batch_sectors * sizeof(sector_info_t));
+            batches[i].payloads = malloc(batch_sectors * 2324);
+        }
+    }
 
+    if(thread_count) {
+        pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+        write_data_batches_threaded(writer, track, batches, batch_count, threads, thread_count);
+        free(threads);
+    } else {
+        const size_t data_len = cd_track_data_size_in_bytes(track);
+        size_t start_lba = track->pregap_sectors;
+        for(size_t offset = 0; offset < data_len; offset += batch_sectors * payload_size) {
+            read_data_batch(writer, track, offset, start_lba, &batches[0]);
+            encode_data_batch(writer, &batches[0]);
+            write_data_batch(writer, &batches[0]);
+            start_lba += batches[0].count;
+        }
+    }
+
+    for(size_t i = 0; i < batch_count; ++i) {
+        free(batches[i].payloads);
+        free(batches[i].sectors);
+        free(batches[i].out);
+        free(batches[i].buffer);
+    }
+    free(batches);
+
+    /* Write the post-gap */
+    write_mode2_pregap(writer, track->postgap_sectors);
 }
 
 static void write_cdi_header(const cd_image_t* image, FILE* output, const char* filename) {
@@ -170,7 +634,8 @@ static void write_cdi_header(const cd_image_t* image, FILE* output, const char*
                   2: Audio,        930h, 2352
                   3: Raw+PQ,       940h, 2352+16 non-interleaved (P=only 1bit)
                   4: Raw+PQRSTUVW, 990h, 2352+96 interleaved */
-            uint32_t read_mode = (cd_track_type(t) == TRACK_TYPE_AUDIO) ? 2 : 1; /* (0 = 2048, 1 = 2336, 2 = 2352)  */
+            uint32_t read_mode = (cd_track_type(t) == TRACK_TYPE_AUDIO) ? 2 :
+                (cd_track_mode(t) == TRACK_MODE_MODE1) ? 0 : 1; /* (0 = 2048, 1 = 2336, 2 = 2352)  */
 
             uint32_t track_length = cd_track_data_size_in_sectors(t) + cd_track_postgap_sectors(t);
 
@@ -280,33 +745,72 @@ bool cd_write_to_cdi(const cd_image_t* image, FILE* output, const char* filename
      * written in sectors, but ignoring the first 16 bytes of header on
      * data tracks, but including the subheader and error correction/detection */
 
+    cdi_writer_t writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.image = image;
+    edc_ctx_init(&writer.edc);
+    writer.progress.track_count = cd_image_track_count(image);
+    writer.start_time = monotonic_seconds();
+    writer.last_report_time = writer.start_time;
+
+    /* Every track's size is known, so the whole file can be allocated up front */
+    uint64_t total_bytes = 0;
+    for(size_t s = 0; s < cd_image_session_count(image); ++s) {
+        cd_session_t* session = cd_image_get_session(image, s);
+        for(size_t t = 0; t < cd_session_track_count(session); ++t) {
+            const cd_track_t* track = cd_session_get_track(session, t);
+            writer.progress.total_sectors += stored_track_sectors(track);
+            total_bytes += (uint64_t) stored_track_sectors(track) * stored_sector_size(track);
+        }
+    }
+
+    image_trace(image, CD_TRACE_BEGIN, "cd_write_to_cdi", 0);
+
+    const size_t output_buffer_size = image->batch_sectors * OUTPUT_BUFFER_BATCHES * 2352;
+    if(!output_open(&writer.output, output, filename, output_buffer_size, image->direct_io)) {
+        image_trace(image, CD_TRACE_END, "cd_write_to_cdi", 0);
+        return false;
+    }
+    output_preallocate(&writer.output, total_bytes);
+
     for(size_t s = 0; s < cd_image_session_count(image); ++s) {
         cd_session_t* session = cd_image_get_session(image, s);
         for(size_t t = 0; t < cd_session_track_count(session); ++t) {
             cd_track_t* track = cd_session_get_track(session, t);
 
+            writer.progress.track++;
+            writer.progress.track_mode = cd_track_mode(track);
+
+            image_trace(image, CD_TRACE_BEGIN, "write_track", 0);
+
             switch(cd_track_mode(track)) {
             case TRACK_MODE_CDDA:
-                write_track_cdda(track, output);
+                write_track_cdda(&writer, track);
             break;
             case TRACK_MODE_MODE1:
-
-            break;
             case TRACK_MODE_MODE2:
-
+                write_track_plain(&writer, track);
             break;
             case TRACK_MODE_XA_MODE2_FORM1:
-                write_track_xa_mode2_form1(track, output);
-            break;
             case TRACK_MODE_XA_MODE2_FORM2:
-                write_track_xa_mode2_form2(track, output);
+                write_track_xa_mode2(&writer, track);
             break;
             }
+
+            image_trace(image, CD_TRACE_END, "write_track", 0);
         }
     }
 
-    write_cdi_header(image, output, filename);    
-    return false;
+    bool ok = output_close(&writer.output);
+
+    image_trace(image, CD_TRACE_BEGIN, "write_cdi_header", 0);
+    write_cdi_header(image, output, filename);
+    image_trace(image, CD_TRACE_END, "write_cdi_header", 0);
+
+    ok = ok && fflush(output) == 0 && !ferror(output);
+
+    image_trace(image, CD_TRACE_END, "cd_write_to_cdi", 0);
+    return ok;
 }
 
 cd_image_t* cd_load_from_cdi(FILE* input) {
@@ -7,10 +7,33 @@
 cd_image_t* cd_new_image() {
     cd_image_t* img = (cd_image_t*) malloc(sizeof(cd_image_t));
     img->first_session = NULL;
+    img->batch_sectors = TRACK_READ_BATCH_SECTORS;
+    img->threads = 1;
+    img->direct_io = false;
+    img->trace_fn = NULL;
+    img->trace_user_data = NULL;
+    img->progress_fn = NULL;
+    img->progress_user_data = NULL;
     strncpy(img->volume_name, "UNNAMED", 255);
     return img;
 }
 
+void cd_image_set_trace_hook(cd_image_t* img, cd_trace_fn trace_fn, void* user_data) {
+    img->trace_fn = trace_fn;
+    img->trace_user_data = user_data;
+}
+
+void cd_image_set_progress_callback(cd_image_t* img, cd_progress_fn progress_fn, void* user_data) {
+    img->progress_fn = progress_fn;
+    img->progress_user_data = user_data;
+}
+
+void image_trace(const cd_image_t* img, cd_trace_event_t event, const char* name, uint64_t value) {
+    if(img->trace_fn) {
+        img->trace_fn(img->trace_user_data, event, name, value);
+    }
+}
+
 void cd_image_set_volume_name(cd_image_t* img, const char* name) {
     strncpy(img->volume_name, name, 255);
 }
@@ -19,8 +42,33 @@ const char* cd_image_volume_name(const cd_image_t* img) {
     return img->volume_name;
 }
 
+void cd_image_set_batch_sectors(cd_image_t* img, size_t sectors) {
+    img->batch_sectors = (sectors) ? sectors : 1;
+}
+
+size_t cd_image_batch_sectors(const cd_image_t* img) {
+    return img->batch_sectors;
+}
+
+void cd_image_set_threads(cd_image_t* img, size_t threads) {
+    if(threads < 1) {
+        threads = 1;
+    } else if(threads > CD_IMAGE_MAX_THREADS) {
+        threads = CD_IMAGE_MAX_THREADS;
+    }
+    img->threads = threads;
+}
+
+size_t cd_image_threads(const cd_image_t* img) {
+    return img->threads;
+}
+
+void cd_image_set_direct_io(cd_image_t* img, bool direct_io) {
+    img->direct_io = direct_io;
+}
+
 static void destroy_track(cd_track_t** t) {
-    free((*t)->data);
+    cd_track_source_free(&(*t)->source);
     free(*t);
     t = NULL;
 }
@@ -180,21 +228,18 @@ cd_track_t* cd_session_get_track(const cd_session_t* session, size_t idx) {
     return found;
 }
 
-cd_track_t* cd_new_track(cd_session_t* session, track_type_t type, const uint8_t* data, const uint32_t data_len) {
+cd_track_t* cd_new_track_from_source(cd_session_t* session, track_type_t type, cd_track_source_t* source) {
     cd_track_t* t = (cd_track_t*) malloc(sizeof(cd_track_t));
     memset(t, 0, sizeof(cd_track_t));
 
     t->session = session;
     t->type = type;
     t->mode = (type == TRACK_TYPE_AUDIO) ? TRACK_MODE_CDDA : TRACK_MODE_XA_MODE2_FORM1;
-    t->data_len = data_len;
-    t->data = malloc(data_len);
+    t->source = source;
     t->start_lba = 0;
     t->pregap_sectors = 150;
     t->postgap_sectors = 0;
 
-    memcpy(t->data, data, data_len);
-
     cd_track_t* i = session->first_track;
     if(!i) {
         session->first_track = t;
@@ -208,22 +253,34 @@ cd_track_t* cd_new_track(cd_session_t* session, track_type_t type, const uint8_t
     return t;
 }
 
+cd_track_t* cd_new_track(cd_session_t* session, track_type_t type, const uint8_t* data, const uint32_t data_len) {
+    uint8_t* copy = malloc(data_len);
+    memcpy(copy, data, data_len);
+    return cd_new_track_from_source(session, type, cd_track_source_adopt_buffer(copy, data_len));
+}
+
+cd_track_t* cd_new_track_streamed(cd_session_t* session, track_type_t type, cd_track_read_fn read_fn, void* user_data, const uint32_t data_len) {
+    return cd_new_track_from_source(session, type, cd_track_source_from_callback(read_fn, user_data, data_len));
+}
+
 cd_track_t* cd_new_track_blank(cd_session_t* session, track_type_t type, const uint32_t data_len) {
-    uint8_t data[data_len];
-    memset(data, 0, data_len);
-    return cd_new_track(session, type, data, data_len);
+    return cd_new_track_from_source(session, type, cd_track_source_zero(data_len));
 }
 
 track_type_t cd_track_type(const cd_track_t* track) {
     return track->type;
 }
 
-uint8_t* cd_track_data(const cd_track_t* track) {
-    return track->data;
+const uint8_t* cd_track_data(const cd_track_t* track) {
+    return track->source->data;
+}
+
+const cd_track_source_t* cd_track_get_source(const cd_track_t* track) {
+    return track->source;
 }
 
 size_t cd_track_data_size_in_bytes(const cd_track_t* track) {
-    return track->data_len;
+    return cd_track_source_length(track->source);
 }
 
 size_t cd_track_total_size_in_sectors(const cd_track_t* track) {
@@ -238,6 +295,11 @@ void cd_track_set_mode(cd_track_t* track, track_mode_t mode) {
     track->mode = mode;
 }
 
+void cd_track_set_sector_hook(cd_track_t* track, cd_track_sector_fn sector_fn, void* user_data) {
+    track->sector_fn = sector_fn;
+    track->sector_user_data = user_data;
+}
+
 void cd_track_set_start_lba(cd_track_t* track, uint32_t lba) {
     track->start_lba = lba;
 }
@@ -277,8 +339,9 @@ size_t cd_track_data_size_in_sectors(const cd_track_t* track) {
         (mode == TRACK_MODE_MODE2) ? 2336 :
         (mode == TRACK_MODE_XA_MODE2_FORM1) ? 2048 : 2324;
 
-    size_t track_sectors = track->data_len / sector_user_data;
-    if(track->data_len % sector_user_data) {
+    size_t data_len = cd_track_data_size_in_bytes(track);
+    size_t track_sectors = data_len / sector_user_data;
+    if(data_len % sector_user_data) {
         track_sectors++;
     }
 
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,13 +33,23 @@ typedef enum {
     TRACK_MODE_XA_MODE2_FORM2,
 } track_mode_t;
 
+typedef enum {
+    TRACK_SOURCE_BUFFER,
+    TRACK_SOURCE_CALLBACK,
+    TRACK_SOURCE_FD,
+    TRACK_SOURCE_MMAP,
+    TRACK_SOURCE_ZERO
+} track_source_type_t;
+
 struct _cd_session_t;
 struct _cd_track_t;
 struct _cd_image_t;
+struct _cd_track_source_t;
 
 typedef struct _cd_session_t cd_session_t;
 typedef struct _cd_track_t cd_track_t;
 typedef struct _cd_image_t cd_image_t;
+typedef struct _cd_track_source_t cd_track_source_t;
 
 cd_image_t* cd_new_image();
 void cd_free_image(cd_image_t** img);
@@ -52,6 +63,25 @@ cd_session_t* cd_image_get_session(const cd_image_t* img, size_t idx);
 void cd_image_set_volume_name(cd_image_t* img, const char* name);
 const char* cd_image_volume_name(const cd_image_t* img);
 
+/* How many sectors are read, encoded and written at a time when the image
+ * is written. Smaller batches use less memory, larger ones make fewer calls
+ * to track sources and the output. The output is buffered four batches at a
+ * time. Defaults to 512. */
+void cd_image_set_batch_sectors(cd_image_t* img, size_t sectors);
+size_t cd_image_batch_sectors(const cd_image_t* img);
+
+/* How many threads encode data tracks when the image is written. Each one
+ * keeps two batches in memory. The output is the same for any number of
+ * threads. Defaults to 1, which encodes on the writing thread. */
+#define CD_IMAGE_MAX_THREADS 64
+void cd_image_set_threads(cd_image_t* img, size_t threads);
+size_t cd_image_threads(const cd_image_t* img);
+
+/* Writes images with O_DIRECT where the platform and file system support
+ * it, so a large image doesn't push everything else out of the page cache.
+ * Ignored otherwise. Off by default. */
+void cd_image_set_direct_io(cd_image_t* img, bool direct_io);
+
 cd_session_t* cd_new_session(cd_image_t* img);
 size_t cd_session_track_count(const cd_session_t* session);
 cd_track_t* cd_session_get_track(const cd_session_t* session, size_t idx);
@@ -80,8 +110,59 @@ cd_track_t* cd_new_track_blank(
     const uint32_t data_len
 );
 
+/* Track sources
+ *
+ * A track source is where a track's data comes from when the image is
+ * written. Sources are read front to back, one batch of sectors at a time,
+ * so a track never has to be held in memory unless it already is. A track
+ * takes ownership of its source. */
+
+/* Reads up to len bytes of track data into buffer. Returns the number of
+ * bytes read, 0 at the end of the data, or < 0 on error */
+typedef int (*cd_track_read_fn)(void* user_data, uint8_t* buffer, size_t len);
+
+/* Data is pulled from read_fn, in order. data_len must be known up front */
+cd_track_source_t* cd_track_source_from_callback(cd_track_read_fn read_fn, void* user_data, size_t data_len);
+
+/* data_len bytes read from fd starting at offset. The fd is not closed */
+cd_track_source_t* cd_track_source_from_fd(int fd, off_t offset, size_t data_len);
+
+/* data_len bytes of fd starting at offset, mapped into memory. The fd can
+ * be closed once the source has been created. Returns NULL on failure */
+cd_track_source_t* cd_track_source_from_mmap(int fd, off_t offset, size_t data_len);
+
+/* Takes ownership of a malloc()ed buffer, no copy is made */
+cd_track_source_t* cd_track_source_adopt_buffer(uint8_t* data, size_t data_len);
+
+/* data_len bytes of zeros, nothing is allocated */
+cd_track_source_t* cd_track_source_zero(size_t data_len);
+
+void cd_track_source_free(cd_track_source_t** source);
+
+track_source_type_t cd_track_source_type(const cd_track_source_t* source);
+size_t cd_track_source_length(const cd_track_source_t* source);
+
+cd_track_t* cd_new_track_from_source(
+    cd_session_t* session,
+    track_type_t type,
+    cd_track_source_t* source
+);
+
+/* Equivalent to cd_new_track_from_source() with a callback source */
+cd_track_t* cd_new_track_streamed(
+    cd_session_t* session,
+    track_type_t type,
+    cd_track_read_fn read_fn,
+    void* user_data,
+    const uint32_t data_len
+);
+
 track_type_t cd_track_type(const cd_track_t* track);
-uint8_t* cd_track_data(const cd_track_t* track);
+
+/* The track's data if it is held in memory (buffer or mmap sources), NULL
+ * otherwise */
+const uint8_t* cd_track_data(const cd_track_t* track);
+const cd_track_source_t* cd_track_get_source(const cd_track_t* track);
 
 size_t cd_track_data_size_in_bytes(const cd_track_t* track);
 size_t cd_track_data_size_in_sectors(const cd_track_t* track);
@@ -91,12 +172,80 @@ size_t cd_track_total_size_in_sectors(const cd_track_t* track);
 track_mode_t cd_track_mode(const cd_track_t* track);
 void cd_track_set_mode(cd_track_t* track, track_mode_t mode);
 
+/* Sector hooks
+ *
+ * XA Mode 2 sectors start with a subheader of file number, channel number,
+ * submode and coding info. Data tracks use {0, 0, DATA | EOR, 0}, with the
+ * FORM2 bit set for Form 2 tracks. A sector hook can give each sector its
+ * own subheader and data, so parts of a Form 1 track can be stored as Form 2
+ * and the other way around.
+ *
+ * The hook is called for each data sector of the track as the image is
+ * written, in order and on the writing thread. sector counts from the start
+ * of the track's data, and data is that sector's payload from the track
+ * source: 2048 bytes for Form 1 tracks, 2324 for Form 2. subheader starts
+ * as the track's usual one and can be changed; the FORM2 bit in the submode
+ * decides how the sector is stored. Return true after filling in payload
+ * (2324 bytes, only the first 2048 are used for Form 1) to store that
+ * instead of data. */
+#define CD_SUBMODE_EOR       0x01
+#define CD_SUBMODE_VIDEO     0x02
+#define CD_SUBMODE_AUDIO     0x04
+#define CD_SUBMODE_DATA      0x08
+#define CD_SUBMODE_TRIGGER   0x10
+#define CD_SUBMODE_FORM2     0x20
+#define CD_SUBMODE_REAL_TIME 0x40
+#define CD_SUBMODE_EOF       0x80
+
+typedef bool (*cd_track_sector_fn)(void* user_data, size_t sector, const uint8_t* data, uint8_t subheader[4], uint8_t* payload);
+
+void cd_track_set_sector_hook(cd_track_t* track, cd_track_sector_fn sector_fn, void* user_data);
+
 
 
 
 void cd_track_set_start_lba(cd_track_t* track, uint32_t lba);
 uint32_t cd_track_start_lba(const cd_track_t* track);
 
+/* Tracing
+ *
+ * The trace hook is called as each stage of writing an image begins and
+ * ends, and with the running totals of counters as they change. Stages nest,
+ * every CD_TRACE_BEGIN is matched by a CD_TRACE_END with the same name.
+ * value is only used by counters. */
+typedef enum {
+    CD_TRACE_BEGIN,
+    CD_TRACE_END,
+    CD_TRACE_COUNTER
+} cd_trace_event_t;
+
+typedef void (*cd_trace_fn)(void* user_data, cd_trace_event_t event, const char* name, uint64_t value);
+
+void cd_image_set_trace_hook(cd_image_t* img, cd_trace_fn trace_fn, void* user_data);
+
+/* Progress
+ *
+ * The progress callback is called each time a batch of sectors has been
+ * written to the output. Sector counts include pregaps and postgaps. */
+typedef struct {
+    size_t track;               /* 1-based, counted across all sessions */
+    size_t track_count;
+    track_mode_t track_mode;
+
+    uint64_t sectors_written;
+    uint64_t total_sectors;
+    uint64_t bytes_written;
+
+    double elapsed_seconds;
+    double mb_per_second;       /* Average since writing started */
+    double current_mb_per_second; /* Since the previous report */
+} cd_progress_t;
+
+typedef void (*cd_progress_fn)(void* user_data, const cd_progress_t* progress);
+
+void cd_image_set_progress_callback(cd_image_t* img, cd_progress_fn progress_fn, void* user_data);
+
+/* Returns false if the image couldn't be written */
 bool cd_write_to_cdi(const cd_image_t* image, FILE* output, const char* filename);
 bool cd_write_to_mds(const cd_image_t* image, FILE* output);
 
@@ -0,0 +1,200 @@
+#include "edc_crc.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EDC_CRC_HAVE_PCLMUL 1
+#include <immintrin.h>
+#endif
+
+#include "edc_tables.h"
+
+/* x^(n-1) mod P, bit reversed into the top half of a 64 bit word, for
+ * folding a 128 bit block forward by n bits */
+#define EDC_FOLD_512_LO 0x6851500100000000ULL /* x^575 mod P */
+#define EDC_FOLD_512_HI 0x1100000100000000ULL /* x^511 mod P */
+#define EDC_FOLD_128_LO 0x5c11c10000000000ULL /* x^191 mod P */
+#define EDC_FOLD_128_HI 0x5101000100000000ULL /* x^127 mod P */
+
+static edc_crc_impl_t selected_impl = EDC_CRC_AUTO;
+
+static unsigned int load_le32(const unsigned char *p)
+{
+    return (unsigned int) p[0] | ((unsigned int) p[1] << 8) |
+           ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+/* The original libedc loop: one dependent table lookup per byte */
+static unsigned int crc_bytewise(unsigned int crc, const unsigned char *p, size_t len)
+{
+    while (len--) {
+        crc = EDC_crc_tables.slice[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+/* Slicing-by-N: N independent lookups per N bytes, so the loads overlap */
+static unsigned int crc_slice8(unsigned int crc, const unsigned char *p, size_t len)
+{
+    while (len >= 8) {
+        unsigned int a = load_le32(p) ^ crc;
+        unsigned int b = load_le32(p + 4);
+
+        crc = EDC_crc_tables.slice[7][a & 0xff] ^ EDC_crc_tables.slice[6][(a >> 8) & 0xff] ^
+              EDC_crc_tables.slice[5][(a >> 16) & 0xff] ^ EDC_crc_tables.slice[4][a >> 24] ^
+              EDC_crc_tables.slice[3][b & 0xff] ^ EDC_crc_tables.slice[2][(b >> 8) & 0xff] ^
+              EDC_crc_tables.slice[1][(b >> 16) & 0xff] ^ EDC_crc_tables.slice[0][b >> 24];
+
+        p += 8;
+        len -= 8;
+    }
+    return crc_bytewise(crc, p, len);
+}
+
+static unsigned int crc_slice16(unsigned int crc, const unsigned char *p, size_t len)
+{
+    while (len >= 16) {
+        unsigned int a = load_le32(p) ^ crc;
+        unsigned int b = load_le32(p + 4);
+        unsigned int c = load_le32(p + 8);
+        unsigned int d = load_le32(p + 12);
+
+        crc = EDC_crc_tables.slice[15][a & 0xff] ^ EDC_crc_tables.slice[14][(a >> 8) & 0xff] ^
+              EDC_crc_tables.slice[13][(a >> 16) & 0xff] ^ EDC_crc_tables.slice[12][a >> 24] ^
+              EDC_crc_tables.slice[11][b & 0xff] ^ EDC_crc_tables.slice[10][(b >> 8) & 0xff] ^
+              EDC_crc_tables.slice[9][(b >> 16) & 0xff] ^ EDC_crc_tables.slice[8][b >> 24] ^
+              EDC_crc_tables.slice[7][c & 0xff] ^ EDC_crc_tables.slice[6][(c >> 8) & 0xff] ^
+              EDC_crc_tables.slice[5][(c >> 16) & 0xff] ^ EDC_crc_tables.slice[4][c >> 24] ^
+              EDC_crc_tables.slice[3][d & 0xff] ^ EDC_crc_tables.slice[2][(d >> 8) & 0xff] ^
+              EDC_crc_tables.slice[1][(d >> 16) & 0xff] ^ EDC_crc_tables.slice[0][d >> 24];
+
+        p += 16;
+        len -= 16;
+    }
+    return crc_slice8(crc, p, len);
+}
+
+#ifdef EDC_CRC_HAVE_PCLMUL
+
+/* Folds a 128 bit block forward by the distance in `k` and adds the next
+ * block. The low qword holds the higher powers of x, so it moves 64 bits
+ * further than the high qword */
+__attribute__((target("pclmul,sse2")))
+static __m128i fold(__m128i x, __m128i k, __m128i next)
+{
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+/* Folds 64 bytes at a time in four lanes, then down to one 16 byte block
+ * that is congruent to everything before it. The CRC of that block and the
+ * remaining bytes is then the CRC of the whole buffer */
+__attribute__((target("pclmul,sse2")))
+static unsigned int crc_pclmul(unsigned int crc, const unsigned char *p, size_t len)
+{
+    const __m128i fold512 = _mm_set_epi64x((long long) EDC_FOLD_512_HI, (long long) EDC_FOLD_512_LO);
+    const __m128i fold128 = _mm_set_epi64x((long long) EDC_FOLD_128_HI, (long long) EDC_FOLD_128_LO);
+    unsigned char block[16];
+    __m128i x0, x1, x2, x3;
+
+    if (len < 64) {
+        return crc_slice16(crc, p, len);
+    }
+
+    /* With no final xor, a running CRC is the same as xoring it into the
+     * first four bytes */
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) p), _mm_cvtsi32_si128((int) crc));
+    x1 = _mm_loadu_si128((const __m128i *) (p + 16));
+    x2 = _mm_loadu_si128((const __m128i *) (p + 32));
+    x3 = _mm_loadu_si128((const __m128i *) (p + 48));
+    p += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x0 = fold(x0, fold512, _mm_loadu_si128((const __m128i *) p));
+        x1 = fold(x1, fold512, _mm_loadu_si128((const __m128i *) (p + 16)));
+        x2 = fold(x2, fold512, _mm_loadu_si128((const __m128i *) (p + 32)));
+        x3 = fold(x3, fold512, _mm_loadu_si128((const __m128i *) (p + 48)));
+        p += 64;
+        len -= 64;
+    }
+
+    x1 = fold(x0, fold128, x1);
+    x2 = fold(x1, fold128, x2);
+    x3 = fold(x2, fold128, x3);
+
+    while (len >= 16) {
+        x3 = fold(x3, fold128, _mm_loadu_si128((const __m128i *) p));
+        p += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *) block, x3);
+    crc = crc_slice16(0, block, sizeof(block));
+    return crc_slice16(crc, p, len);
+}
+
+#endif
+
+static int supported(edc_crc_impl_t impl)
+{
+    if (impl == EDC_CRC_PCLMUL) {
+#ifdef EDC_CRC_HAVE_PCLMUL
+        return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+#else
+        return 0;
+#endif
+    }
+    return 1;
+}
+
+edc_crc_impl_t edc_crc_current(void)
+{
+    if (selected_impl != EDC_CRC_AUTO) {
+        return selected_impl;
+    }
+    return supported(EDC_CRC_PCLMUL) ? EDC_CRC_PCLMUL : EDC_CRC_SLICE16;
+}
+
+unsigned int edc_crc(unsigned int crc, const unsigned char *p, size_t len)
+{
+    return edc_crc_with(edc_crc_current(), crc, p, len);
+}
+
+unsigned int edc_crc_with(edc_crc_impl_t impl, unsigned int crc, const unsigned char *p, size_t len)
+{
+    switch (impl) {
+    case EDC_CRC_BYTEWISE:
+        return crc_bytewise(crc, p, len);
+    case EDC_CRC_SLICE8:
+        return crc_slice8(crc, p, len);
+#ifdef EDC_CRC_HAVE_PCLMUL
+    case EDC_CRC_PCLMUL:
+        return crc_pclmul(crc, p, len);
+#endif
+    default:
+        return crc_slice16(crc, p, len);
+    }
+}
+
+int edc_crc_select(edc_crc_impl_t impl)
+{
+    if (!supported(impl)) {
+        return 0;
+    }
+    selected_impl = impl;
+    return 1;
+}
+
+const char *edc_crc_name(void)
+{
+    switch (edc_crc_current()) {
+    case EDC_CRC_BYTEWISE:
+        return "bytewise";
+    case EDC_CRC_SLICE8:
+        return "slice8";
+    case EDC_CRC_PCLMUL:
+        return "pclmul";
+    default:
+        return "slice16";
+    }
+}
@@ -0,0 +1,34 @@
+/* CD-ROM EDC (CRC-32, polynomial 0xd8018001 bit reversed, no initial or
+ * final xor) with several implementations. They all give the same result;
+ * edc_crc() picks the fastest one the CPU supports. */
+
+#ifndef __EDC_CRC_H__
+#define __EDC_CRC_H__
+
+#include <stddef.h>
+
+typedef enum {
+    EDC_CRC_AUTO,
+    EDC_CRC_BYTEWISE,
+    EDC_CRC_SLICE8,
+    EDC_CRC_SLICE16,
+    EDC_CRC_PCLMUL
+} edc_crc_impl_t;
+
+/* Continues the EDC of `crc` over len bytes. Start with crc = 0 */
+unsigned int edc_crc(unsigned int crc, const unsigned char *p, size_t len);
+
+/* edc_crc() with a given implementation, which has to be supported */
+unsigned int edc_crc_with(edc_crc_impl_t impl, unsigned int crc, const unsigned char *p, size_t len);
+
+/* The implementation edc_crc() uses at the moment, never EDC_CRC_AUTO */
+edc_crc_impl_t edc_crc_current(void);
+
+/* Forces an implementation, mostly for benchmarks. Returns 0 if the CPU
+ * doesn't support it. Not thread safe, call before encoding starts */
+int edc_crc_select(edc_crc_impl_t impl);
+
+/* Name of the implementation edc_crc() is using */
+const char *edc_crc_name(void);
+
+#endif /* __EDC_CRC_H__ */
@@ -106,7 +106,7 @@ scramble_L2(inout)
 	return (0);
 }
 
-#include "l2sq_table"
+#include "edc_rspc.h"
 
 int encode_L2_Q	__PR((unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P + L2_Q]));
 
@@ -114,42 +114,7 @@ int
 encode_L2_Q(inout)
 	unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P + L2_Q];
 {
-	unsigned char *dps;
-	unsigned char *dp;
-	unsigned char *Q;
-	register int i;
-	int j;
-
-	Q = inout + 4 + L2_RAW + 4 + 8 + L2_P;
-
-	dps = inout;
-	for (j = 0; j < 26; j++) {
-		register unsigned short a;
-		register unsigned short b;
-		a = b = 0;
-
-		dp = dps;
-		for (i = 0; i < 43; i++) {
-
-			/* LSB */
-			a ^= L2sq[i][*dp++];
-
-			/* MSB */
-			b ^= L2sq[i][*dp];
-
-			dp += 2*44-1;
-			if (dp >= &inout[(4 + L2_RAW + 4 + 8 + L2_P)]) {
-				dp -= (4 + L2_RAW + 4 + 8 + L2_P);
-			} 
-		}
-		Q[0]      = a >> 8;
-		Q[26*2]   = a;
-		Q[1]      = b >> 8;
-		Q[26*2+1] = b;
-
-		Q += 2;
-		dps += 2*43;
-	}
+	edc_rspc_encode_q(inout);
 	return (0);
 }
 
@@ -159,76 +124,11 @@ int
 encode_L2_P(inout)
 	unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P];
 {
-	unsigned char *dp;
-	unsigned char *P;
-	register int i;
-	int j;
-
-	P = inout + 4 + L2_RAW + 4 + 8;
-
-	for (j = 0; j < 43; j++) {
-		register unsigned short a;
-		register unsigned short b;
-
-		a = b = 0;
-		dp = inout;
-		for (i = 19; i < 43; i++) {
-
-			/* LSB */
-			a ^= L2sq[i][*dp++];
-
-			/* MSB */
-			b ^= L2sq[i][*dp];
-
-			dp += 2*43 -1;
-		}
-		P[0]      = a >> 8;
-		P[43*2]   = a;
-		P[1]      = b >> 8;
-		P[43*2+1] = b;
-
-		P += 2;
-		inout += 2;
-	}
+	edc_rspc_encode_p(inout);
 	return (0);
 }
 
-static unsigned char bin2bcd	__PR((unsigned p));
-
-static unsigned char
-bin2bcd(p)
-	unsigned p;
-{
-	return ((p/10)<<4)|(p%10);
-}
-
-static int build_address	__PR((unsigned char inout[], int sectortype, unsigned address));
-
-static int
-build_address(inout, sectortype, address)
-	unsigned char inout[];
-	int sectortype;
-	unsigned address;
-{
-	inout[12] = bin2bcd(address / (60*75));
-	inout[13] = bin2bcd((address / 75) % 60);
-	inout[14] = bin2bcd(address % 75);
-	if (sectortype == MODE_0)
-		inout[15] = 0;
-	else if (sectortype == MODE_1)
-		inout[15] = 1;
-	else if (sectortype == MODE_2)
-		inout[15] = 2;
-	else if (sectortype == MODE_2_FORM_1)
-		inout[15] = 2;
-	else if (sectortype == MODE_2_FORM_2)
-		inout[15] = 2;
-	else
-		return (-1);
-	return (0);
-}
-
-#include "crctable.out"
+#include "edc_crc.h"
 
 /*
  * Called with 2064, 2056 or 2332 byte difference - all dividable by 4.
@@ -241,20 +141,11 @@ build_edc(inout, from, upto)
 	int from;
 	int upto;
 {
-	unsigned char *p = inout+from;
-	unsigned int result = 0;
-
-	upto -= from-1;
-	upto /= 4;
-	while (--upto >= 0) {
-		result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
-		result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
-		result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
-		result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
-	}
-	return (result);
+	return (edc_crc(0, inout+from, (upto-from+1) & ~3));
 }
 
+#include "libedc.h"
+
 /* Layer 2 Product code en/decoder */
 int do_encode_L2 __PR((unsigned char *inout, int sectortype, unsigned address));
 
@@ -264,65 +155,11 @@ do_encode_L2(inout, sectortype, address)
 	int sectortype;
 	unsigned address;
 {
-	unsigned int result;
-
-/*	SYNCPATTERN "\x00\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff" */
-#define SYNCPATTERN "\000\377\377\377\377\377\377\377\377\377\377"
-
-	/* supply initial sync pattern */
-	memcpy(inout, SYNCPATTERN, sizeof(SYNCPATTERN));
-
-	if (sectortype == MODE_0) {
-		memset(inout + sizeof(SYNCPATTERN), 0, 4 + L2_RAW + 12 + L2_P + L2_Q);
-		build_address(inout, sectortype, address);
-		return (0);
-	}
-
-	switch (sectortype) {
+	edc_ctx_t ctx;
 
-	case MODE_1:
-		build_address(inout, sectortype, address);
-		result = build_edc(inout, 0, 16+2048-1);
-		inout[2064+0] = result >> 0L;
-		inout[2064+1] = result >> 8L;
-		inout[2064+2] = result >> 16L;
-		inout[2064+3] = result >> 24L;
-		memset(inout+2064+4, 0, 8);
-		encode_L2_P(inout+12);
-		encode_L2_Q(inout+12);
-		break;
-	case MODE_2:
-		build_address(inout, sectortype, address);
-		break;
-	case MODE_2_FORM_1:
-		result = build_edc(inout, 16, 16+8+2048-1);
-		inout[2072+0] = result >> 0L;
-		inout[2072+1] = result >> 8L;
-		inout[2072+2] = result >> 16L;
-		inout[2072+3] = result >> 24L;
-
-		/* clear header for P/Q parity calculation */
-		inout[12] = 0;
-		inout[12+1] = 0;
-		inout[12+2] = 0;
-		inout[12+3] = 0;
-		encode_L2_P(inout+12);
-		encode_L2_Q(inout+12);
-		build_address(inout, sectortype, address);
-		break;
-	case MODE_2_FORM_2:
-		build_address(inout, sectortype, address);
-		result = build_edc(inout, 16, 16+8+2324-1);
-		inout[2348+0] = result >> 0L;
-		inout[2348+1] = result >> 8L;
-		inout[2348+2] = result >> 16L;
-		inout[2348+3] = result >> 24L;
-		break;
-	default:
-		return (-1);
-	}
-
-	return (0);
+	/* The encoders for each sector type are in sector_encoder.cpp */
+	edc_ctx_init(&ctx);
+	return (edc_encode_batch(&ctx, inout, 1, address, sectortype));
 }
 
 
@@ -0,0 +1,415 @@
+#include "edc_rspc.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EDC_RSPC_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define EDC_RSPC_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "edc_tables.h"
+
+/*
+ * The sector is 43 byte pairs wide. P parity covers 24 rows of it and is
+ * written after them; Q parity covers 26 rows (the data plus P) along
+ * wrapping diagonals.
+ *
+ * Each parity byte is the sum of one input byte per row, multiplied by a
+ * coefficient that only depends on the row. So a vector of adjacent
+ * columns can be multiplied by the same constant, with the nibble tables
+ * in EDC_rspc_tables.mul as 16 byte shuffles. For Q the diagonals are
+ * first lined up as rows.
+ */
+#define ROW_BYTES 86
+#define P_ROWS 24
+#define Q_ROWS 26
+#define Q_BYTES 52
+
+static edc_rspc_impl_t selected_impl = EDC_RSPC_AUTO;
+
+/* The original libedc encoders, one L2sq lookup per byte. P walks down the
+ * columns and Q along the diagonals, wrapping at the end of the Q area */
+static void encode_p_table(unsigned char *inout)
+{
+    unsigned char *p = inout + P_ROWS * ROW_BYTES;
+    int i, j;
+
+    for (j = 0; j < 43; j++) {
+        const unsigned char *dp = inout + 2*j;
+        unsigned short a = 0;
+        unsigned short b = 0;
+
+        for (i = 19; i < 43; i++) {
+            a ^= EDC_rspc_tables.l2sq[i][dp[0]];
+            b ^= EDC_rspc_tables.l2sq[i][dp[1]];
+            dp += ROW_BYTES;
+        }
+
+        p[2*j] = a >> 8;
+        p[2*j + ROW_BYTES] = a;
+        p[2*j + 1] = b >> 8;
+        p[2*j + ROW_BYTES + 1] = b;
+    }
+}
+
+static void encode_q_table(unsigned char *inout)
+{
+    unsigned char *q = inout + Q_ROWS * ROW_BYTES;
+    int i, j;
+
+    for (j = 0; j < Q_ROWS; j++) {
+        int offset = j * ROW_BYTES;
+        unsigned short a = 0;
+        unsigned short b = 0;
+
+        for (i = 0; i < 43; i++) {
+            a ^= EDC_rspc_tables.l2sq[i][inout[offset]];
+            b ^= EDC_rspc_tables.l2sq[i][inout[offset + 1]];
+
+            offset += ROW_BYTES + 2;
+            if (offset >= Q_ROWS * ROW_BYTES) {
+                offset -= Q_ROWS * ROW_BYTES;
+            }
+        }
+
+        q[2*j] = a >> 8;
+        q[2*j + Q_BYTES] = a;
+        q[2*j + 1] = b >> 8;
+        q[2*j + Q_BYTES + 1] = b;
+    }
+}
+
+#ifdef EDC_RSPC_HAVE_X86
+
+/* Transposes the 26 x 43 byte pairs of the Q area so each column is a row of
+ * t, stored twice so that any rotation of it is one contiguous run:
+ * t[i][2*(r + 26*n) + b] = byte b of the pair in row r, column i. Works on
+ * 8 x 8 blocks of pairs, padding the rows to 32 and the columns to 48 */
+__attribute__((target("sse2")))
+static void transpose_q(const unsigned char *inout, unsigned char t[48][128])
+{
+    /* The last block of rows goes first: its padding lands on the start of
+     * the second copy, which the other blocks then overwrite */
+    static const int row_blocks[4] = {24, 0, 8, 16};
+    int rb, col, k;
+
+    for (rb = 0; rb < 4; rb++) {
+        int row = row_blocks[rb];
+
+        for (col = 0; col < 48; col += 8) {
+            __m128i a[8], u[8], v[8];
+
+            for (k = 0; k < 8; k++) {
+                a[k] = (row + k < Q_ROWS)
+                    ? _mm_loadu_si128((const __m128i *) (inout + (row + k) * ROW_BYTES + 2*col))
+                    : _mm_setzero_si128();
+            }
+
+            for (k = 0; k < 8; k += 2) {
+                u[k] = _mm_unpacklo_epi16(a[k], a[k+1]);
+                u[k+1] = _mm_unpackhi_epi16(a[k], a[k+1]);
+            }
+
+            v[0] = _mm_unpacklo_epi32(u[0], u[2]);
+            v[1] = _mm_unpackhi_epi32(u[0], u[2]);
+            v[2] = _mm_unpacklo_epi32(u[1], u[3]);
+            v[3] = _mm_unpackhi_epi32(u[1], u[3]);
+            v[4] = _mm_unpacklo_epi32(u[4], u[6]);
+            v[5] = _mm_unpackhi_epi32(u[4], u[6]);
+            v[6] = _mm_unpacklo_epi32(u[5], u[7]);
+            v[7] = _mm_unpackhi_epi32(u[5], u[7]);
+
+            for (k = 0; k < 4; k++) {
+                __m128i even = _mm_unpacklo_epi64(v[k], v[k+4]);
+                __m128i odd = _mm_unpackhi_epi64(v[k], v[k+4]);
+
+                _mm_storeu_si128((__m128i *) &t[col + 2*k][2*row], even);
+                _mm_storeu_si128((__m128i *) &t[col + 2*k][2*(row + Q_ROWS)], even);
+                _mm_storeu_si128((__m128i *) &t[col + 2*k + 1][2*row], odd);
+                _mm_storeu_si128((__m128i *) &t[col + 2*k + 1][2*(row + Q_ROWS)], odd);
+            }
+        }
+    }
+}
+
+#else
+
+/* Lines up the Q diagonals as rows: q[i][2*j+b] is byte b of the pair in
+ * row (i + j) % 26, column i */
+static void gather_q(const unsigned char *inout, unsigned char q[43][Q_BYTES])
+{
+    int row, i, j;
+
+    /* Pairs are copied whole, reading along the sector rows */
+    for (row = 0; row < Q_ROWS; row++) {
+        const unsigned char *src = inout + row * ROW_BYTES;
+
+        j = row;
+        for (i = 0; i < 43; i++) {
+            memcpy(&q[i][2*j], src + 2*i, 2);
+            if (--j < 0) {
+                j = Q_ROWS - 1;
+            }
+        }
+    }
+}
+
+#endif
+
+/*
+ * parity_*(): for each of `width` columns, sums rows[k][col] * coefficient k
+ * over `count` rows, for both halves of the code. The last
+ * vector overlaps the one before it when width isn't a multiple of its
+ * size, which just writes the same bytes twice.
+ */
+
+#ifdef EDC_RSPC_HAVE_X86
+
+__attribute__((target("ssse3")))
+static void parity_ssse3(const unsigned char *const *rows, int count,
+                         const unsigned char (*mul)[2][2][16], int width,
+                         unsigned char *out_a, unsigned char *out_b)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    int offset, k;
+
+    for (offset = 0; offset < width; offset += 16) {
+        __m128i a = _mm_setzero_si128();
+        __m128i b = _mm_setzero_si128();
+
+        if (offset + 16 > width) {
+            offset = width - 16;
+        }
+
+        for (k = 0; k < count; k++) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (rows[k] + offset));
+            __m128i lo = _mm_and_si128(x, nibble);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+
+            a = _mm_xor_si128(a, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) mul[k][0][0]), lo));
+            a = _mm_xor_si128(a, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) mul[k][0][1]), hi));
+            b = _mm_xor_si128(b, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) mul[k][1][0]), lo));
+            b = _mm_xor_si128(b, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) mul[k][1][1]), hi));
+        }
+
+        _mm_storeu_si128((__m128i *) (out_a + offset), a);
+        _mm_storeu_si128((__m128i *) (out_b + offset), b);
+    }
+}
+
+__attribute__((target("avx2")))
+static void parity_avx2(const unsigned char *const *rows, int count,
+                        const unsigned char (*mul)[2][2][16], int width,
+                        unsigned char *out_a, unsigned char *out_b)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    int offset, k;
+
+    for (offset = 0; offset < width; offset += 32) {
+        __m256i a = _mm256_setzero_si256();
+        __m256i b = _mm256_setzero_si256();
+
+        if (offset + 32 > width) {
+            offset = width - 32;
+        }
+
+        for (k = 0; k < count; k++) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) (rows[k] + offset));
+            __m256i lo = _mm256_and_si256(x, nibble);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+
+            a = _mm256_xor_si256(a, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) mul[k][0][0])), lo));
+            a = _mm256_xor_si256(a, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) mul[k][0][1])), hi));
+            b = _mm256_xor_si256(b, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) mul[k][1][0])), lo));
+            b = _mm256_xor_si256(b, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) mul[k][1][1])), hi));
+        }
+
+        _mm256_storeu_si256((__m256i *) (out_a + offset), a);
+        _mm256_storeu_si256((__m256i *) (out_b + offset), b);
+    }
+}
+
+#endif
+
+#ifdef EDC_RSPC_HAVE_NEON
+
+static void parity_neon(const unsigned char *const *rows, int count,
+                        const unsigned char (*mul)[2][2][16], int width,
+                        unsigned char *out_a, unsigned char *out_b)
+{
+    const uint8x16_t nibble = vdupq_n_u8(0x0f);
+    int offset, k;
+
+    for (offset = 0; offset < width; offset += 16) {
+        uint8x16_t a = vdupq_n_u8(0);
+        uint8x16_t b = vdupq_n_u8(0);
+
+        if (offset + 16 > width) {
+            offset = width - 16;
+        }
+
+        for (k = 0; k < count; k++) {
+            uint8x16_t x = vld1q_u8(rows[k] + offset);
+            uint8x16_t lo = vandq_u8(x, nibble);
+            uint8x16_t hi = vshrq_n_u8(x, 4);
+
+            a = veorq_u8(a, vqtbl1q_u8(vld1q_u8(mul[k][0][0]), lo));
+            a = veorq_u8(a, vqtbl1q_u8(vld1q_u8(mul[k][0][1]), hi));
+            b = veorq_u8(b, vqtbl1q_u8(vld1q_u8(mul[k][1][0]), lo));
+            b = veorq_u8(b, vqtbl1q_u8(vld1q_u8(mul[k][1][1]), hi));
+        }
+
+        vst1q_u8(out_a + offset, a);
+        vst1q_u8(out_b + offset, b);
+    }
+}
+
+#endif
+
+static int supported(edc_rspc_impl_t impl)
+{
+    switch (impl) {
+#ifdef EDC_RSPC_HAVE_X86
+    case EDC_RSPC_SSSE3:
+        return __builtin_cpu_supports("ssse3");
+    case EDC_RSPC_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef EDC_RSPC_HAVE_NEON
+    case EDC_RSPC_NEON:
+        return 1;
+#endif
+    case EDC_RSPC_AUTO:
+    case EDC_RSPC_TABLE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+edc_rspc_impl_t edc_rspc_current(void)
+{
+    if (selected_impl != EDC_RSPC_AUTO) {
+        return selected_impl;
+    }
+    if (supported(EDC_RSPC_AVX2)) {
+        return EDC_RSPC_AVX2;
+    }
+    if (supported(EDC_RSPC_SSSE3)) {
+        return EDC_RSPC_SSSE3;
+    }
+    if (supported(EDC_RSPC_NEON)) {
+        return EDC_RSPC_NEON;
+    }
+    return EDC_RSPC_TABLE;
+}
+
+/* Runs the parity kernel for impl, 0 if it's the table encoder */
+static int parity(edc_rspc_impl_t impl, const unsigned char *const *rows, int count,
+                  const unsigned char (*mul)[2][2][16], int width,
+                  unsigned char *out_a, unsigned char *out_b)
+{
+    switch (impl) {
+#ifdef EDC_RSPC_HAVE_X86
+    case EDC_RSPC_SSSE3:
+        parity_ssse3(rows, count, mul, width, out_a, out_b);
+        return 1;
+    case EDC_RSPC_AVX2:
+        parity_avx2(rows, count, mul, width, out_a, out_b);
+        return 1;
+#endif
+#ifdef EDC_RSPC_HAVE_NEON
+    case EDC_RSPC_NEON:
+        parity_neon(rows, count, mul, width, out_a, out_b);
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+void edc_rspc_encode_p(unsigned char *inout)
+{
+    edc_rspc_encode_p_with(edc_rspc_current(), inout);
+}
+
+void edc_rspc_encode_q(unsigned char *inout)
+{
+    edc_rspc_encode_q_with(edc_rspc_current(), inout);
+}
+
+void edc_rspc_encode_p_with(edc_rspc_impl_t impl, unsigned char *inout)
+{
+    const unsigned char *rows[P_ROWS];
+    unsigned char *p = inout + P_ROWS * ROW_BYTES;
+    int k;
+
+    for (k = 0; k < P_ROWS; k++) {
+        rows[k] = inout + k * ROW_BYTES;
+    }
+
+    /* P uses coefficients 19 to 42 */
+    if (!parity(impl, rows, P_ROWS, EDC_rspc_tables.mul + 19, ROW_BYTES, p, p + ROW_BYTES)) {
+        encode_p_table(inout);
+    }
+}
+
+void edc_rspc_encode_q_with(edc_rspc_impl_t impl, unsigned char *inout)
+{
+    const unsigned char *rows[43];
+    unsigned char *q = inout + Q_ROWS * ROW_BYTES;
+    int i;
+#ifdef EDC_RSPC_HAVE_X86
+    unsigned char t[48][128];
+#else
+    unsigned char t[43][Q_BYTES];
+#endif
+
+    if (impl == EDC_RSPC_TABLE) {
+        encode_q_table(inout);
+        return;
+    }
+
+    /* Diagonal i starts at row i % 26 of column i */
+#ifdef EDC_RSPC_HAVE_X86
+    transpose_q(inout, t);
+    for (i = 0; i < 43; i++) {
+        rows[i] = t[i] + 2 * (i % Q_ROWS);
+    }
+#else
+    gather_q(inout, t);
+    for (i = 0; i < 43; i++) {
+        rows[i] = t[i];
+    }
+#endif
+
+    parity(impl, rows, 43, EDC_rspc_tables.mul, Q_BYTES, q, q + Q_BYTES);
+}
+
+int edc_rspc_select(edc_rspc_impl_t impl)
+{
+    if (!supported(impl)) {
+        return 0;
+    }
+    selected_impl = impl;
+    return 1;
+}
+
+const char *edc_rspc_name(void)
+{
+    switch (edc_rspc_current()) {
+    case EDC_RSPC_SSSE3:
+        return "ssse3";
+    case EDC_RSPC_AVX2:
+        return "avx2";
+    case EDC_RSPC_NEON:
+        return "neon";
+    default:
+        return "table";
+    }
+}
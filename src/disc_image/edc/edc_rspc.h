@@ -0,0 +1,34 @@
+/* Layer 2 (RSPC) P and Q parity encoders: the original L2sq table version
+ * and SIMD versions that give the same bytes. The fastest one the CPU
+ * supports is used by default. */
+
+#ifndef __EDC_RSPC_H__
+#define __EDC_RSPC_H__
+
+typedef enum {
+    EDC_RSPC_AUTO,
+    EDC_RSPC_TABLE,
+    EDC_RSPC_SSSE3,
+    EDC_RSPC_AVX2,
+    EDC_RSPC_NEON
+} edc_rspc_impl_t;
+
+/* Same arguments as encode_L2_P() and encode_L2_Q(), which call these */
+void edc_rspc_encode_p(unsigned char *inout);
+void edc_rspc_encode_q(unsigned char *inout);
+
+/* The same with a given implementation, which has to be supported */
+void edc_rspc_encode_p_with(edc_rspc_impl_t impl, unsigned char *inout);
+void edc_rspc_encode_q_with(edc_rspc_impl_t impl, unsigned char *inout);
+
+/* The implementation in use at the moment, never EDC_RSPC_AUTO */
+edc_rspc_impl_t edc_rspc_current(void);
+
+/* Forces an implementation, mostly for benchmarks. Returns 0 if the CPU
+ * doesn't support it. Not thread safe, call before encoding starts */
+int edc_rspc_select(edc_rspc_impl_t impl);
+
+/* Name of the implementation in use */
+const char *edc_rspc_name(void);
+
+#endif /* __EDC_RSPC_H__ */
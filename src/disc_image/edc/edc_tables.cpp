@@ -0,0 +1,98 @@
+#include "edc_tables.h"
+
+namespace {
+
+/* x^32 + x^31 + x^16 + x^15 + x^4 + x^3 + x + 1, bit reversed */
+constexpr unsigned int EDC_POLYNOMIAL = 0xd8018001;
+
+/* x^8 + x^4 + x^3 + x^2 + 1 */
+constexpr unsigned int GF_POLYNOMIAL = 0x11d;
+
+constexpr edc_crc_tables_t make_crc_tables() {
+    edc_crc_tables_t tables{};
+
+    for(unsigned int i = 0; i < 256; ++i) {
+        unsigned int crc = i;
+        for(int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ EDC_POLYNOMIAL : crc >> 1;
+        }
+        tables.slice[0][i] = crc;
+    }
+
+    for(int k = 1; k < 16; ++k) {
+        for(unsigned int i = 0; i < 256; ++i) {
+            unsigned int prev = tables.slice[k - 1][i];
+            tables.slice[k][i] = (prev >> 8) ^ tables.slice[0][prev & 0xff];
+        }
+    }
+
+    return tables;
+}
+
+constexpr unsigned int gf_mul(unsigned int a, unsigned int b) {
+    unsigned int product = 0;
+    while(b) {
+        if(b & 1) {
+            product ^= a;
+        }
+        a <<= 1;
+        if(a & 0x100) {
+            a ^= GF_POLYNOMIAL;
+        }
+        b >>= 1;
+    }
+    return product;
+}
+
+constexpr unsigned int gf_pow(unsigned int a, unsigned int n) {
+    unsigned int result = 1;
+    while(n--) {
+        result = gf_mul(result, a);
+    }
+    return result;
+}
+
+/* Each P or Q codeword is n = 26 or 45 bytes, ending in its two parity
+ * bytes, and both its sum and its sum weighted by alpha^(n-1-i) are zero.
+ * Solving for the parity bytes, byte i contributes
+ *   A = (alpha^(n-1-i) + 1) / (alpha + 1)
+ *   B = (alpha^(n-1-i) + alpha) / (alpha + 1) = A + 1
+ * P codewords use the last 24 of the 43 coefficients. */
+constexpr edc_rspc_tables_t make_rspc_tables() {
+    edc_rspc_tables_t tables{};
+    const unsigned int inverse_alpha_plus_1 = gf_pow(3, 254);
+
+    for(unsigned int i = 0; i < 43; ++i) {
+        const unsigned int coefficients[2] = {
+            gf_mul(gf_pow(2, 44 - i) ^ 1, inverse_alpha_plus_1),
+            gf_mul(gf_pow(2, 44 - i) ^ 1, inverse_alpha_plus_1) ^ 1
+        };
+
+        for(unsigned int v = 0; v < 256; ++v) {
+            tables.l2sq[i][v] = (unsigned short) (gf_mul(v, coefficients[0]) << 8 | gf_mul(v, coefficients[1]));
+        }
+
+        for(int c = 0; c < 2; ++c) {
+            for(unsigned int v = 0; v < 16; ++v) {
+                tables.mul[i][c][0][v] = (unsigned char) gf_mul(v, coefficients[c]);
+                tables.mul[i][c][1][v] = (unsigned char) gf_mul(v << 4, coefficients[c]);
+            }
+        }
+    }
+
+    return tables;
+}
+
+constexpr edc_crc_tables_t CRC_TABLES = make_crc_tables();
+constexpr edc_rspc_tables_t RSPC_TABLES = make_rspc_tables();
+
+/* Spot checks against the tables libedc used to ship */
+static_assert(CRC_TABLES.slice[0][1] == 0x90910101, "EDC table");
+static_assert(CRC_TABLES.slice[0][255] == 0x7070ff00, "EDC table");
+static_assert(RSPC_TABLES.l2sq[0][1] == 0xaeaf, "L2sq table");
+static_assert(RSPC_TABLES.l2sq[42][1] == 0x0302, "L2sq table");
+
+}
+
+extern "C" const edc_crc_tables_t EDC_crc_tables = CRC_TABLES;
+extern "C" const edc_rspc_tables_t EDC_rspc_tables = RSPC_TABLES;
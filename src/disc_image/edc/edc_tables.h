@@ -0,0 +1,38 @@
+/* Lookup tables for the EDC and RSPC encoders, computed at compile time by
+ * edc_tables.cpp rather than generated into source files. */
+
+#ifndef __EDC_TABLES_H__
+#define __EDC_TABLES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    /* slice[0] is the usual byte at a time table for the EDC polynomial,
+     * slice[k] advances a byte k further:
+     *   slice[k][i] = (slice[k-1][i] >> 8) ^ slice[0][slice[k-1][i] & 0xff] */
+    unsigned int slice[16][256];
+} edc_crc_tables_t;
+
+typedef struct {
+    /* Byte i of a P or Q codeword adds v * A_i to the first parity byte and
+     * v * B_i to the second, over GF(2^8) generated by
+     * x^8 + x^4 + x^3 + x^2 + 1. l2sq[i][v] packs both products:
+     * (v * A_i) << 8 | (v * B_i) */
+    unsigned short l2sq[43][256];
+
+    /* The same products split by nibble, to fit in a 16 byte shuffle:
+     *   v * c = mul[i][c][0][v & 15] ^ mul[i][c][1][v >> 4]
+     * where c is 0 for A_i and 1 for B_i */
+    unsigned char mul[43][2][2][16];
+} edc_rspc_tables_t;
+
+extern const edc_crc_tables_t EDC_crc_tables;
+extern const edc_rspc_tables_t EDC_rspc_tables;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __EDC_TABLES_H__ */
@@ -1,5 +1,10 @@
-#include "libedc.h"
-
-int edc_encode_sector(unsigned char *buf, unsigned int address) {
-	return do_encode_L2(buf, MODE_2_FORM_1, address);
-}
+#include "libedc.h"
+
+int edc_encode_sector(unsigned char *buf, unsigned int address) {
+	return do_encode_L2(buf, MODE_2_FORM_1, address);
+}
+
+void edc_ctx_init(edc_ctx_t *ctx) {
+	ctx->crc = edc_crc_current();
+	ctx->rspc = edc_rspc_current();
+}
@@ -1,26 +1,47 @@
-/* This header contains all info needed for encoding an ISO Mode 2 Form 1 sector. */
-
-#ifndef __LIBEDC_H__
-#define __LIBEDC_H__
-
-// libedc includes
-#include "patch.h"
-#include "ecc.h"
-#include "edc.h"
-
-#include <stdio.h>
-#include <string.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#define EDC_LOAD_OFFSET 24
-#define EDC_ENCODE_ADDRESS 0 + (75 * 2)
-#define EDC_SECTOR_SIZE_DECODE (16 + L2_RAW + 12 + L2_Q + L2_P) /* Layer 2 decode */
-#define EDC_SECTOR_SIZE_ENCODE L2_RAW /* Layer 2 encode */
-#define EDC_MODE_2_FORM_1_DATA_SECTOR_SIZE (LSUB_RAW + LSUB_Q + LSUB_P) * PACKETS_PER_SUBCHANNELFRAME + (L2_RAW + L2_Q + L2_P) * FRAMES_PER_SECTOR
-
-int edc_encode_sector(unsigned char *buf, unsigned int address);
-
-#endif /* __LIBEDC_H__ */
+/* This header contains all info needed for encoding an ISO Mode 2 Form 1 sector. */
+
+#ifndef __LIBEDC_H__
+#define __LIBEDC_H__
+
+// libedc includes
+#include "patch.h"
+#include "ecc.h"
+#include "edc.h"
+#include "edc_crc.h"
+#include "edc_rspc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EDC_LOAD_OFFSET 24
+#define EDC_ENCODE_ADDRESS 0 + (75 * 2)
+#define EDC_SECTOR_SIZE_DECODE (16 + L2_RAW + 12 + L2_Q + L2_P) /* Layer 2 decode */
+#define EDC_SECTOR_SIZE_ENCODE L2_RAW /* Layer 2 encode */
+#define EDC_MODE_2_FORM_1_DATA_SECTOR_SIZE (LSUB_RAW + LSUB_Q + LSUB_P) * PACKETS_PER_SUBCHANNELFRAME + (L2_RAW + L2_Q + L2_P) * FRAMES_PER_SECTOR
+#define EDC_RAW_SECTOR_SIZE 2352
+
+int edc_encode_sector(unsigned char *buf, unsigned int address);
+
+/* Encoder state for edc_encode_batch(). The EDC and RSPC implementations are
+   picked when it's initialised, so encoding reads no global state and each
+   thread can encode with a context of its own. */
+typedef struct {
+	edc_crc_impl_t crc;
+	edc_rspc_impl_t rspc;
+} edc_ctx_t;
+
+void edc_ctx_init(edc_ctx_t *ctx);
+
+/* Encodes n_sectors raw sectors of EDC_RAW_SECTOR_SIZE bytes, back to back
+   in buf, in place. Each one is laid out and filled in as by do_encode_L2(),
+   with the address start_lba plus its index. Form 1 sectors that repeat
+   one earlier in the batch copy its parity instead of computing it. Returns
+   -1 for an unknown sector type. */
+int edc_encode_batch(const edc_ctx_t *ctx, unsigned char *buf, size_t n_sectors,
+	unsigned int start_lba, int sector_type);
+
+#endif /* __LIBEDC_H__ */
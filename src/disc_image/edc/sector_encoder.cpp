@@ -0,0 +1,148 @@
+/* The Layer 2 sector encoders behind edc_encode_batch() and do_encode_L2().
+ * Each sector type is its own template instance, so the type is picked
+ * once per batch and the per sector loop has no switch in it. */
+
+#include <cstring>
+
+extern "C" {
+#include "libedc.h"
+}
+
+namespace {
+
+constexpr unsigned char SYNC[12] = {
+    0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00
+};
+
+/* The header's mode byte */
+template<int SectorType>
+constexpr unsigned char MODE_BYTE = (SectorType == MODE_0 || SectorType == MODE_1) ? SectorType : 2;
+
+constexpr unsigned char bcd(unsigned int value) {
+    return (unsigned char) (((value / 10) << 4) | (value % 10));
+}
+
+inline void put_edc(unsigned char* out, unsigned int edc) {
+    out[0] = (unsigned char) edc;
+    out[1] = (unsigned char) (edc >> 8);
+    out[2] = (unsigned char) (edc >> 16);
+    out[3] = (unsigned char) (edc >> 24);
+}
+
+/* Form 1 sectors encoded earlier in the batch, looked up by EDC. The parity
+ * doesn't depend on the address, so a sector with the same subheader and
+ * data as one of these (runs of padding, mostly) can copy its EDC and P/Q
+ * rather than computing them again. */
+class Form1Cache {
+public:
+    /* Returns an earlier sector with the same subheader and data, or NULL
+     * after remembering this one. The stored EDC is checked first, so
+     * different sectors that share a slot are usually told apart without a
+     * memcmp() */
+    const unsigned char* lookup(const unsigned char* sector, unsigned int edc) {
+        const unsigned char*& entry = m_Sectors[(edc ^ (edc >> 16)) & (SIZE - 1)];
+        const unsigned char* hit = entry;
+
+        unsigned char edc_bytes[4];
+        put_edc(edc_bytes, edc);
+        if(hit && std::memcmp(hit + 2072, edc_bytes, 4) == 0 &&
+           std::memcmp(hit + 16, sector + 16, 8 + 2048) == 0) {
+            return hit;
+        }
+
+        entry = sector;
+        return NULL;
+    }
+
+private:
+    static constexpr int SIZE = 16;
+    const unsigned char* m_Sectors[SIZE] = {};
+};
+
+template<int SectorType>
+inline void encode_sector(const edc_ctx_t& ctx, unsigned char* buf, const unsigned char header[4], Form1Cache& cache) {
+    std::memcpy(buf, SYNC, sizeof(SYNC));
+
+    if constexpr(SectorType == MODE_0) {
+        std::memset(buf + 16, 0, EDC_RAW_SECTOR_SIZE - 16);
+        std::memcpy(buf + 12, header, 4);
+    } else if constexpr(SectorType == MODE_1) {
+        std::memcpy(buf + 12, header, 4);
+        put_edc(buf + 2064, edc_crc_with(ctx.crc, 0, buf, 2064));
+        std::memset(buf + 2068, 0, 8);
+        edc_rspc_encode_p_with(ctx.rspc, buf + 12);
+        edc_rspc_encode_q_with(ctx.rspc, buf + 12);
+    } else if constexpr(SectorType == MODE_2) {
+        std::memcpy(buf + 12, header, 4);
+    } else if constexpr(SectorType == MODE_2_FORM_1) {
+        unsigned int edc = edc_crc_with(ctx.crc, 0, buf + 16, 8 + 2048);
+        const unsigned char* cached = cache.lookup(buf, edc);
+        if(cached) {
+            std::memcpy(buf + 2072, cached + 2072, EDC_RAW_SECTOR_SIZE - 2072);
+        } else {
+            put_edc(buf + 2072, edc);
+
+            /* The header is zero for the P/Q parity calculation */
+            std::memset(buf + 12, 0, 4);
+            edc_rspc_encode_p_with(ctx.rspc, buf + 12);
+            edc_rspc_encode_q_with(ctx.rspc, buf + 12);
+        }
+        std::memcpy(buf + 12, header, 4);
+    } else if constexpr(SectorType == MODE_2_FORM_2) {
+        std::memcpy(buf + 12, header, 4);
+        put_edc(buf + 2348, edc_crc_with(ctx.crc, 0, buf + 16, 8 + 2324));
+    }
+}
+
+template<int SectorType>
+void encode_sectors(const edc_ctx_t& ctx, unsigned char* buf, size_t n_sectors, unsigned int start_lba) {
+    /* The address is stepped along in MSF rather than divided out per sector */
+    unsigned int minute = start_lba / (60 * 75);
+    unsigned int second = (start_lba / 75) % 60;
+    unsigned int frame = start_lba % 75;
+    unsigned char header[4] = {0, 0, 0, MODE_BYTE<SectorType>};
+    Form1Cache cache;
+
+    /* Each sector goes through every stage before the next one starts, so
+     * it stays in L1 throughout */
+    for(size_t i = 0; i < n_sectors; ++i, buf += EDC_RAW_SECTOR_SIZE) {
+        header[0] = bcd(minute);
+        header[1] = bcd(second);
+        header[2] = bcd(frame);
+
+        encode_sector<SectorType>(ctx, buf, header, cache);
+
+        if(++frame == 75) {
+            frame = 0;
+            if(++second == 60) {
+                second = 0;
+                minute++;
+            }
+        }
+    }
+}
+
+}
+
+extern "C" int edc_encode_batch(const edc_ctx_t* ctx, unsigned char* buf, size_t n_sectors,
+                                unsigned int start_lba, int sector_type) {
+    switch(sector_type) {
+    case MODE_0:
+        encode_sectors<MODE_0>(*ctx, buf, n_sectors, start_lba);
+        return 0;
+    case MODE_1:
+        encode_sectors<MODE_1>(*ctx, buf, n_sectors, start_lba);
+        return 0;
+    case MODE_2:
+        encode_sectors<MODE_2>(*ctx, buf, n_sectors, start_lba);
+        return 0;
+    case MODE_2_FORM_1:
+        encode_sectors<MODE_2_FORM_1>(*ctx, buf, n_sectors, start_lba);
+        return 0;
+    case MODE_2_FORM_2:
+        encode_sectors<MODE_2_FORM_2>(*ctx, buf, n_sectors, start_lba);
+        return 0;
+    default:
+        return -1;
+    }
+}
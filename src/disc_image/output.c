@@ -0,0 +1,260 @@
+/* pwritev() and O_DIRECT are Linux extensions, pwrite() and
+ * posix_memalign() aren't part of C99 */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#elif !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "disc_image.h"
+#include "private.h"
+
+/* Buffer address, file offset and length alignment for O_DIRECT */
+#define OUTPUT_ALIGNMENT 4096
+
+/* Entries passed to one pwritev(), well under any IOV_MAX */
+#define OUTPUT_MAX_PIECES 256
+
+typedef struct {
+    const uint8_t* data;
+    size_t len;
+} output_piece_t;
+
+/* Writes the pieces back to back at the output's offset, and moves it on */
+static void write_pieces(image_output_t* out, int fd, output_piece_t* pieces, size_t count) {
+    size_t first = 0;
+    while(first < count && !out->failed) {
+#if defined(__linux__)
+        struct iovec iov[OUTPUT_MAX_PIECES];
+        size_t n = 0;
+        for(; n < OUTPUT_MAX_PIECES && first + n < count; ++n) {
+            iov[n].iov_base = (void*) pieces[first + n].data;
+            iov[n].iov_len = pieces[first + n].len;
+        }
+        ssize_t written = pwritev(fd, iov, (int) n, (off_t) out->offset);
+#elif defined(_WIN32)
+        int written = -1;
+        if(_lseeki64(fd, out->offset, SEEK_SET) >= 0) {
+            written = _write(fd, pieces[first].data, (unsigned int) pieces[first].len);
+        }
+#else
+        ssize_t written = pwrite(fd, pieces[first].data, pieces[first].len, (off_t) out->offset);
+#endif
+        if(written <= 0) {
+            out->failed = true;
+            break;
+        }
+
+        /* Skip what was written, which may end part way through a piece */
+        out->offset += written;
+        while(written > 0) {
+            if((size_t) written >= pieces[first].len) {
+                written -= pieces[first].len;
+                ++first;
+            } else {
+                pieces[first].data += written;
+                pieces[first].len -= written;
+                written = 0;
+            }
+        }
+    }
+}
+
+/* Writes the buffer. With direct I/O only whole blocks are written unless
+ * this is the final flush, and the rest is moved to the front */
+static void flush_buffer(image_output_t* out, bool final) {
+    if(out->direct_fd >= 0) {
+        size_t aligned = out->buffer_used & ~(size_t) (OUTPUT_ALIGNMENT - 1);
+        output_piece_t piece = {out->buffer, aligned};
+        write_pieces(out, out->direct_fd, &piece, (aligned) ? 1 : 0);
+
+        out->buffer_used -= aligned;
+        memmove(out->buffer, out->buffer + aligned, out->buffer_used);
+        if(!final) {
+            return;
+        }
+    }
+
+    output_piece_t piece = {out->buffer, out->buffer_used};
+    write_pieces(out, out->fd, &piece, (out->buffer_used) ? 1 : 0);
+    out->buffer_used = 0;
+}
+
+bool output_open(image_output_t* out, FILE* file, const char* filename, size_t buffer_size, bool direct_io) {
+    memset(out, 0, sizeof(*out));
+    out->file = file;
+    out->direct_fd = -1;
+
+    fflush(file);
+#ifdef _WIN32
+    out->fd = _fileno(file);
+    __int64 position = _ftelli64(file);
+#else
+    out->fd = fileno(file);
+    off_t position = ftello(file);
+#endif
+    if(position < 0) {
+        return false;
+    }
+    out->offset = position;
+
+    out->buffer_size = (buffer_size + OUTPUT_ALIGNMENT - 1) & ~(size_t) (OUTPUT_ALIGNMENT - 1);
+#ifdef _WIN32
+    out->buffer = malloc(out->buffer_size);
+#else
+    void* buffer = NULL;
+    out->buffer = (posix_memalign(&buffer, OUTPUT_ALIGNMENT, out->buffer_size) == 0) ? buffer : NULL;
+#endif
+    if(!out->buffer) {
+        return false;
+    }
+
+    /* Direct I/O needs a block aligned start, otherwise it's just skipped */
+#ifdef O_DIRECT
+    if(direct_io && filename && out->offset % OUTPUT_ALIGNMENT == 0) {
+        out->direct_fd = open(filename, O_WRONLY | O_DIRECT);
+    }
+#endif
+
+    return true;
+}
+
+void output_write(image_output_t* out, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*) data;
+
+    /* Anything that doesn't fit goes out with the buffer, uncopied */
+    if(out->direct_fd < 0 && len > out->buffer_size - out->buffer_used) {
+        output_piece_t pieces[2];
+        size_t n = 0;
+        if(out->buffer_used) {
+            pieces[n].data = out->buffer;
+            pieces[n++].len = out->buffer_used;
+            out->buffer_used = 0;
+        }
+        pieces[n].data = p;
+        pieces[n++].len = len;
+        write_pieces(out, out->fd, pieces, n);
+        return;
+    }
+
+    while(len) {
+        size_t n = out->buffer_size - out->buffer_used;
+        if(n > len) {
+            n = len;
+        }
+
+        memcpy(out->buffer + out->buffer_used, p, n);
+        out->buffer_used += n;
+        p += n;
+        len -= n;
+
+        if(out->buffer_used == out->buffer_size) {
+            flush_buffer(out, false);
+        }
+    }
+}
+
+void output_repeat(image_output_t* out, const void* sector, size_t len, size_t count) {
+    if(out->direct_fd >= 0) {
+        for(size_t i = 0; i < count; ++i) {
+            output_write(out, sector, len);
+        }
+        return;
+    }
+
+    /* The buffer, then the sector over and over */
+    output_piece_t pieces[OUTPUT_MAX_PIECES];
+    size_t n = 0;
+    if(out->buffer_used) {
+        pieces[n].data = out->buffer;
+        pieces[n++].len = out->buffer_used;
+        out->buffer_used = 0;
+    }
+
+    while(count) {
+        for(; count && n < OUTPUT_MAX_PIECES; --count, ++n) {
+            pieces[n].data = (const uint8_t*) sector;
+            pieces[n].len = len;
+        }
+        write_pieces(out, out->fd, pieces, n);
+        n = 0;
+    }
+
+    if(n) {
+        write_pieces(out, out->fd, pieces, n);
+    }
+}
+
+void output_preallocate(image_output_t* out, uint64_t len) {
+#if defined(__linux__)
+    if(len) {
+        fallocate(out->fd, 0, (off_t) (out->offset + out->buffer_used), (off_t) len);
+    }
+#endif
+}
+
+bool output_can_write_at(const image_output_t* out) {
+#ifdef _WIN32
+    /* _write() goes from the shared file position */
+    return false;
+#else
+    /* Direct writes have to stay block aligned, which a gap would break */
+    return out->direct_fd < 0;
+#endif
+}
+
+uint64_t output_skip(image_output_t* out, uint64_t len) {
+    flush_buffer(out, true);
+
+    uint64_t start = out->offset;
+    out->offset += len;
+    return start;
+}
+
+bool output_write_at(const image_output_t* out, uint64_t offset, const void* data, size_t len) {
+#ifdef _WIN32
+    return false;
+#else
+    const uint8_t* p = (const uint8_t*) data;
+    while(len) {
+        ssize_t written = pwrite(out->fd, p, len, (off_t) offset);
+        if(written <= 0) {
+            return false;
+        }
+        p += written;
+        offset += written;
+        len -= written;
+    }
+    return true;
+#endif
+}
+
+bool output_close(image_output_t* out) {
+    flush_buffer(out, true);
+
+#ifdef O_DIRECT
+    if(out->direct_fd >= 0) {
+        close(out->direct_fd);
+    }
+#endif
+    free(out->buffer);
+    out->buffer = NULL;
+
+#ifdef _WIN32
+    _fseeki64(out->file, out->offset, SEEK_SET);
+#else
+    fseeko(out->file, (off_t) out->offset, SEEK_SET);
+#endif
+    return !out->failed;
+}
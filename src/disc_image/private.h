@@ -2,20 +2,56 @@
 
 #include "disc_image.h"
 
+/* How many sectors worth of data are read at a time from track sources,
+ * unless changed with cd_image_set_batch_sectors() */
+#define TRACK_READ_BATCH_SECTORS 512
+
+/* The output buffer holds this many batches worth of raw sectors */
+#define OUTPUT_BUFFER_BATCHES 4
+
+struct _cd_track_source_t {
+    track_source_type_t type;
+    size_t data_len;
+
+    /* TRACK_SOURCE_BUFFER and TRACK_SOURCE_MMAP */
+    uint8_t* data;
+
+    /* TRACK_SOURCE_MMAP, the mapping starts on a page boundary before data */
+    void* map_base;
+    size_t map_len;
+
+    /* TRACK_SOURCE_CALLBACK */
+    cd_track_read_fn read_fn;
+    void* read_user_data;
+    size_t read_position;
+
+    /* TRACK_SOURCE_FD */
+    int fd;
+    off_t offset;
+};
+
+/* Returns the len bytes of source data starting at offset. Memory backed
+ * sources are returned in place, everything else is read into buffer.
+ * Callback sources must be read in order. Anything a source fails to
+ * provide is zero filled. */
+const uint8_t* track_source_read(cd_track_source_t* source, size_t offset, uint8_t* buffer, size_t len);
+
 struct _cd_track_t {
     cd_session_t* session;
 
     track_type_t type;
     track_mode_t mode;
 
-    uint8_t* data;
-    size_t data_len;
+    cd_track_source_t* source;
 
     size_t pregap_sectors;
     size_t postgap_sectors;
 
     uint32_t start_lba;
 
+    cd_track_sector_fn sector_fn;
+    void* sector_user_data;
+
     cd_track_t* next_track;
 };
 
@@ -28,4 +64,58 @@ struct _cd_session_t {
 struct _cd_image_t {
     char volume_name[255];
     cd_session_t* first_session;
+
+    size_t batch_sectors;
+    size_t threads;
+    bool direct_io;
+
+    cd_trace_fn trace_fn;
+    void* trace_user_data;
+
+    cd_progress_fn progress_fn;
+    void* progress_user_data;
 };
+
+/* Calls the image's trace hook, if there is one */
+void image_trace(const cd_image_t* img, cd_trace_event_t event, const char* name, uint64_t value);
+
+/* Writes an image in large blocks. Small writes are gathered in an aligned
+ * buffer; a write that doesn't fit goes out in the same pwritev() as the
+ * buffer, without being copied. Runs of identical sectors (gaps) are one
+ * pwritev() with every entry pointing at the same sector. With direct I/O
+ * everything goes through the buffer, which is written with O_DIRECT in
+ * whole blocks.
+ *
+ * Writing starts at the FILE's position, and output_close() leaves it at the
+ * end of what was written, so the caller can carry on with stdio. */
+typedef struct {
+    FILE* file;
+    int fd;
+    int direct_fd;          /* -1 unless direct I/O was asked for and works */
+    uint64_t offset;        /* Where the buffer will be written */
+
+    uint8_t* buffer;
+    size_t buffer_size;
+    size_t buffer_used;
+
+    bool failed;
+} image_output_t;
+
+bool output_open(image_output_t* out, FILE* file, const char* filename, size_t buffer_size, bool direct_io);
+void output_write(image_output_t* out, const void* data, size_t len);
+void output_repeat(image_output_t* out, const void* sector, size_t len, size_t count);
+
+/* Reserves space for the len bytes from the current position on, to avoid
+ * fragmenting the file. Only a hint, it does nothing where unsupported */
+void output_preallocate(image_output_t* out, uint64_t len);
+
+/* For writing from other threads: output_skip() leaves a gap of len bytes
+ * and returns where it starts, then output_write_at() fills it in. That can
+ * be called from any thread at once, as long as output_can_write_at() */
+bool output_can_write_at(const image_output_t* out);
+uint64_t output_skip(image_output_t* out, uint64_t len);
+bool output_write_at(const image_output_t* out, uint64_t offset, const void* data, size_t len);
+
+/* Writes anything left and frees the buffer. Returns false if any write
+ * failed */
+bool output_close(image_output_t* out);
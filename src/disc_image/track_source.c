@@ -0,0 +1,194 @@
+/* pread() and posix_madvise() aren't part of C99 */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "disc_image.h"
+#include "private.h"
+
+static cd_track_source_t* new_source(track_source_type_t type, size_t data_len) {
+    cd_track_source_t* s = (cd_track_source_t*) malloc(sizeof(cd_track_source_t));
+    memset(s, 0, sizeof(cd_track_source_t));
+    s->type = type;
+    s->data_len = data_len;
+    s->fd = -1;
+    return s;
+}
+
+cd_track_source_t* cd_track_source_from_callback(cd_track_read_fn read_fn, void* user_data, size_t data_len) {
+    cd_track_source_t* s = new_source(TRACK_SOURCE_CALLBACK, data_len);
+    s->read_fn = read_fn;
+    s->read_user_data = user_data;
+    return s;
+}
+
+cd_track_source_t* cd_track_source_from_fd(int fd, off_t offset, size_t data_len) {
+    cd_track_source_t* s = new_source(TRACK_SOURCE_FD, data_len);
+    s->fd = fd;
+    s->offset = offset;
+    return s;
+}
+
+cd_track_source_t* cd_track_source_from_mmap(int fd, off_t offset, size_t data_len) {
+    if(!data_len) {
+        return cd_track_source_zero(0);
+    }
+
+    /* Touching a mapping beyond the end of the file is fatal */
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (uint64_t) offset + data_len > (uint64_t) info.st_size) {
+        return NULL;
+    }
+
+#ifdef _WIN32
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    off_t granularity = system_info.dwAllocationGranularity;
+#else
+    off_t granularity = sysconf(_SC_PAGESIZE);
+#endif
+
+    /* Mappings have to start on a page (or allocation granularity) boundary */
+    off_t map_offset = offset - (offset % granularity);
+    size_t map_len = data_len + (offset - map_offset);
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMapping((HANDLE) _get_osfhandle(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!mapping) {
+        return NULL;
+    }
+
+    void* base = MapViewOfFile(
+        mapping, FILE_MAP_READ,
+        (DWORD) ((uint64_t) map_offset >> 32), (DWORD) map_offset,
+        map_len
+    );
+    CloseHandle(mapping);
+    if(!base) {
+        return NULL;
+    }
+#else
+    void* base = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_offset);
+    if(base == MAP_FAILED) {
+        return NULL;
+    }
+
+    posix_madvise(base, map_len, POSIX_MADV_SEQUENTIAL);
+#endif
+
+    cd_track_source_t* s = new_source(TRACK_SOURCE_MMAP, data_len);
+    s->map_base = base;
+    s->map_len = map_len;
+    s->data = (uint8_t*) base + (offset - map_offset);
+    return s;
+}
+
+cd_track_source_t* cd_track_source_adopt_buffer(uint8_t* data, size_t data_len) {
+    cd_track_source_t* s = new_source(TRACK_SOURCE_BUFFER, data_len);
+    s->data = data;
+    return s;
+}
+
+cd_track_source_t* cd_track_source_zero(size_t data_len) {
+    return new_source(TRACK_SOURCE_ZERO, data_len);
+}
+
+void cd_track_source_free(cd_track_source_t** source) {
+    cd_track_source_t* s = *source;
+    if(!s) {
+        return;
+    }
+
+    if(s->type == TRACK_SOURCE_BUFFER) {
+        free(s->data);
+    } else if(s->type == TRACK_SOURCE_MMAP) {
+#ifdef _WIN32
+        UnmapViewOfFile(s->map_base);
+#else
+        munmap(s->map_base, s->map_len);
+#endif
+    }
+
+    free(s);
+    *source = NULL;
+}
+
+track_source_type_t cd_track_source_type(const cd_track_source_t* source) {
+    return source->type;
+}
+
+size_t cd_track_source_length(const cd_track_source_t* source) {
+    return source->data_len;
+}
+
+static size_t read_fd(cd_track_source_t* source, size_t offset, uint8_t* buffer, size_t len) {
+    size_t filled = 0;
+    while(filled < len) {
+        off_t position = source->offset + (off_t) (offset + filled);
+#ifdef _WIN32
+        int read = -1;
+        if(_lseeki64(source->fd, position, SEEK_SET) >= 0) {
+            read = _read(source->fd, buffer + filled, (unsigned int) (len - filled));
+        }
+#else
+        ssize_t read = pread(source->fd, buffer + filled, len - filled, position);
+#endif
+        if(read <= 0) {
+            break;
+        }
+        filled += read;
+    }
+    return filled;
+}
+
+static size_t read_callback(cd_track_source_t* source, size_t offset, uint8_t* buffer, size_t len) {
+    if(offset != source->read_position) {
+        /* Callback sources can only be read front to back */
+        return 0;
+    }
+
+    size_t filled = 0;
+    while(filled < len) {
+        int read = source->read_fn(source->read_user_data, buffer + filled, len - filled);
+        if(read <= 0) {
+            break;
+        }
+        filled += read;
+    }
+
+    source->read_position += filled;
+    return filled;
+}
+
+const uint8_t* track_source_read(cd_track_source_t* source, size_t offset, uint8_t* buffer, size_t len) {
+    size_t filled = 0;
+
+    switch(source->type) {
+    case TRACK_SOURCE_BUFFER:
+    case TRACK_SOURCE_MMAP:
+        return source->data + offset;
+    case TRACK_SOURCE_CALLBACK:
+        filled = read_callback(source, offset, buffer, len);
+    break;
+    case TRACK_SOURCE_FD:
+        filled = read_fd(source, offset, buffer, len);
+    break;
+    case TRACK_SOURCE_ZERO:
+    break;
+    }
+
+    memset(buffer + filled, 0, len - filled);
+    return buffer;
+}
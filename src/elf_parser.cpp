@@ -28,18 +28,80 @@
 #include "elf_parser.hpp"
 
 #include <algorithm>
-#include <cassert>
-#include <fstream>
+#include <iomanip>
 #include <iterator>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace elfparser {
 
+std::shared_ptr<MappedFile> MappedFile::Open(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return nullptr;
+
+    void* base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!base)
+        return nullptr;
+
+    return std::shared_ptr<MappedFile>(new MappedFile(base, (size_t) size.QuadPart));
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    // Mapping an empty file fails, and it wouldn't be an ELF anyway
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return nullptr;
+
+    return std::shared_ptr<MappedFile>(new MappedFile(base, (size_t) info.st_size));
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    UnmapViewOfFile(m_Base);
+#else
+    munmap(m_Base, m_Size);
+#endif
+}
+
 /**
  *  Selects the segments from an elf which should
  *  be loaded into memory and place them into a
  *  vector of bytes starting at 0x8c010000.
  */
-bool Parser::fill_bin(std::vector<char>& bin_data)
+bool Parser::fill_bin(std::vector<char>& bin_data, bool trim_bss)
 {
     // remove non-loadable segments and ones that are not in the loadable region
     auto end_valid = std::remove_if(m_Segments.begin(), m_Segments.end(), 
@@ -74,16 +136,37 @@ bool Parser::fill_bin(std::vector<char>& bin_data)
 
     size_t start = min_max.first->get_physaddr();
     size_t end = min_max.second->get_physaddr() + min_max.second->get_memsize();
+    m_MemoryEnd = end;
+
+    // The program's startup code clears .bss, so anything after the last
+    // byte from the file doesn't need to be stored. Zeros in between do
+    if (trim_bss) {
+        end = start;
+        for (const Segment& segment : m_Segments) {
+            if (segment.get_filesize() != 0)
+                end = std::max<size_t>(end, segment.get_physaddr() + segment.get_filesize());
+        }
+
+        if (end == start) {
+            std::cerr << "No loadable segments have data in the file!" << std::endl;
+            return false;
+        }
+    }
 
     // Binary should always start at DC_RAM_START_ADDR on Dreamcast
     if (start != DC_RAM_START_ADDR) {
-        std::cerr << "Unexpected binary start at 0x" << std::hex << start << ", expected " << DC_RAM_START_ADDR << std::endl;
+        auto flags = std::cerr.flags();
+        std::cerr << "Unexpected binary start at 0x" << std::hex << start << ", expected 0x" << DC_RAM_START_ADDR << std::endl;
+        std::cerr.flags(flags);
         return false;
     }
     
+    // Addresses are shown in hex, leave std::cout as it was for everything after
+    auto flags = std::cout.flags();
     std::cout << "Binary start: 0x" << std::hex << start << '\t';
     std::cout << "Binary end:   0x" << std::hex << end << '\t';
     std::cout << "Binary size:  0x" << std::hex << (end - start) << std::endl;
+    std::cout.flags(flags);
 
     if ( !bin_data.empty()) {
         std::cerr << "Failed to empty binary vector!" << std::endl;
@@ -98,27 +181,90 @@ bool Parser::fill_bin(std::vector<char>& bin_data)
             continue;
         // Offset from begining of binary
         auto offset = segment.get_physaddr() - start;
-        // Get data from segment and copy it into the binary    
+        // Copy the segment straight from the ELF into the binary
         segment.write_data_to(&bin_data[offset], segment.get_filesize());
     }
+
+    m_Start = start;
+    m_End = end;
     return true;
 }
 
-std::optional<std::shared_ptr<Parser>> Parser::Load(const std::vector<char>& elf_data)
+/**
+ *  Where the bytes of the binary made by fill_bin come from,
+ *  by segment and by section, and how many of them are zeros.
+ */
+void Parser::print_size_report(std::ostream& out) const
+{
+    auto flags = out.flags();
+
+    // How much of [from, from + size) lands inside the binary
+    auto stored = [this](size_t from, size_t size) -> size_t {
+        size_t first = std::max<size_t>(from, m_Start);
+        size_t last = std::min<size_t>(from + size, m_End);
+        return (last > first) ? last - first : 0;
+    };
+
+    size_t file_bytes = 0;
+    out << "1ST_READ.BIN segments:" << std::endl;
+    out << "  " << std::left << std::setw(12) << "address" << std::right << std::setw(10) << "file"
+        << std::setw(10) << "memory" << std::setw(10) << "stored" << std::endl;
+    for (const Segment& segment : m_Segments) {
+        out << "  0x" << std::left << std::hex << std::setw(10) << segment.get_physaddr() << std::right << std::dec
+            << std::setw(10) << segment.get_filesize() << std::setw(10) << segment.get_memsize()
+            << std::setw(10) << stored(segment.get_physaddr(), segment.get_memsize()) << std::endl;
+        file_bytes += stored(segment.get_physaddr(), segment.get_filesize());
+    }
+
+    out << "1ST_READ.BIN sections:" << std::endl;
+    out << "  " << std::left << std::setw(20) << "name" << std::setw(12) << "address" << std::right
+        << std::setw(10) << "size" << std::setw(10) << "stored" << std::endl;
+    for (const Section& section : m_Sections) {
+        if (!(section.get_flags() & SHF_ALLOC) || section.get_size() == 0)
+            continue;
+
+        // Sections have virtual addresses, the binary is laid out by the
+        // physical addresses of the segments holding them
+        auto segment = std::find_if(m_Segments.begin(), m_Segments.end(), [&section](const Segment& segment) {
+            return section.get_addr() >= segment.get_virtaddr() &&
+                   section.get_addr() - segment.get_virtaddr() < segment.get_memsize();
+        });
+        if (segment == m_Segments.end())
+            continue;
+        size_t address = segment->get_physaddr() + (section.get_addr() - segment->get_virtaddr());
+
+        out << "  " << std::left << std::setw(20) << section.get_name() << "0x" << std::hex << std::setw(10) << address
+            << std::right << std::dec << std::setw(10) << section.get_size()
+            << std::setw(10) << stored(address, section.get_size())
+            << ((section.get_type() == SHT_NOBITS) ? " (nobits)" : "") << std::endl;
+    }
+
+    out << "  " << (m_End - m_Start) << " bytes stored, " << file_bytes << " from the file, "
+        << (m_End - m_Start) - file_bytes << " zeros";
+    if (m_MemoryEnd > m_End)
+        out << ", " << (m_MemoryEnd - m_End) << " bytes of trailing .bss trimmed";
+    out << std::endl;
+
+    out.flags(flags);
+}
+
+std::optional<std::shared_ptr<Parser>> Parser::Load(DataView elf_data, std::shared_ptr<MappedFile> mapping)
 {
-    const char * elf_start = &elf_data[0];
+    const char * elf_start = elf_data.data();
     // Really make sure this is an elf
-    assert(elf_data[0] == 0x7F);
-    assert(elf_data[1] == 'E');
-    assert(elf_data[2] == 'L');
-    assert(elf_data[3] == 'F');
+    if (!elf_data.contains(0, sizeof(Elf32_Ehdr)) || memcmp(elf_start, "\x7f" "ELF", 4) != 0) {
+        std::cerr << "Not an ELF file" << std::endl;
+        return {};
+    }
 
     // ELF header starts at the begining of the file
-    const Elf32_Ehdr* elf_header = (const Elf32_Ehdr*)&elf_data[0];
+    const Elf32_Ehdr* elf_header = (const Elf32_Ehdr*)elf_start;
 
     // Check if ELF is for SuperH
     if( elf_header->e_machine != EM_SH ) {
+        auto flags = std::cout.flags();
         std::cout << "Unsupported Architecture (0x" << std::hex << elf_header->e_machine << ")" << std::endl;
+        std::cout.flags(flags);
         return {};
     }
 
@@ -145,16 +291,29 @@ std::optional<std::shared_ptr<Parser>> Parser::Load(const std::vector<char>& elf
     auto section_entry_size = elf_header->e_shentsize;
     // Each entry in the section header table is e_shnum bytes long
     auto section_entry_count = elf_header->e_shnum;
+
+    // Both tables have to be inside the file, with entries at least as big
+    // as the structures read from them
+    bool segments_fit = segment_entry_count == 0 || (segment_entry_size >= sizeof(Elf32_Phdr) &&
+        elf_data.contains(elf_header->e_phoff, size_t(segment_entry_size) * segment_entry_count));
+    bool sections_fit = section_entry_size >= sizeof(Elf32_Shdr) && elf_header->e_shstrndx < section_entry_count &&
+        elf_data.contains(elf_header->e_shoff, size_t(section_entry_size) * section_entry_count);
+    if (!segments_fit || !sections_fit) {
+        std::cerr << "ELF header tables don't fit inside the file" << std::endl;
+        return {};
+    }
     
     // String look up table can be found using section header table with an index of e_shstrndx
     const Elf32_Shdr* string_names_section = (const Elf32_Shdr*) (section_header_table + (elf_header->e_shstrndx * section_entry_size));
-    // Get pointer to the string names data using the offset from the Section Header
-    const char * string_names_data = elf_start + string_names_section->sh_offset;
     // Make sure the string names section is a string table
     if (string_names_section->sh_type != SHT_STRTAB) {
-        std::cerr << "Expected section header selected by e_shstrndx to be a string table (%d)" << std::hex << string_names_section->sh_type << std::endl;
+        auto flags = std::cerr.flags();
+        std::cerr << "Expected section header selected by e_shstrndx to be a string table (0x" << std::hex << string_names_section->sh_type << ")" << std::endl;
+        std::cerr.flags(flags);
         return {};
     }
+    // Get the string names data using the offset from the Section Header
+    DataView string_names_data = elf_data.subview(string_names_section->sh_offset, string_names_section->sh_size);
     
     //
     // Parse Segments
@@ -162,8 +321,13 @@ std::optional<std::shared_ptr<Parser>> Parser::Load(const std::vector<char>& elf
     for( int index = 0; index < segment_entry_count; index++ ) {
         // Pointer to Program Header at index
         auto program_header = (const Elf32_Phdr*)(program_header_table + (index * segment_entry_size));
+        // The segment's data, straight from the ELF
+        if (!elf_data.contains(program_header->p_offset, program_header->p_filesz)) {
+            std::cerr << "Segment " << index << " reaches past the end of the ELF" << std::endl;
+            return {};
+        }
         // Add segment to list of segments
-        segments.push_back(Segment(program_header, elf_data));
+        segments.push_back(Segment(program_header, elf_data.subview(program_header->p_offset, program_header->p_filesz)));
     }
 
     //
@@ -172,29 +336,47 @@ std::optional<std::shared_ptr<Parser>> Parser::Load(const std::vector<char>& elf
     for( int index = 0; index < section_entry_count; index++ ) {
         // Pointer to Section Header at index
         auto section_header = (const Elf32_Shdr*)(section_header_table + (index * section_entry_size));
-        // Get the name of the section from the string names table
-        const char * name = string_names_data + section_header->sh_name;
+        // Get the name of the section from the string names table, which
+        // has to end inside the table
+        size_t name_offset = section_header->sh_name;
+        if (name_offset >= string_names_data.size() ||
+            !memchr(string_names_data.data() + name_offset, 0, string_names_data.size() - name_offset)) {
+            std::cerr << "Section " << index << " has no name in the string table" << std::endl;
+            return {};
+        }
+        const char * name = string_names_data.data() + name_offset;
+        // Only PROGBITS sections have their data in the file
+        DataView data;
+        if (section_header->sh_type == SHT_PROGBITS) {
+            if (!elf_data.contains(section_header->sh_offset, section_header->sh_size)) {
+                std::cerr << "Section " << name << " reaches past the end of the ELF" << std::endl;
+                return {};
+            }
+            data = elf_data.subview(section_header->sh_offset, section_header->sh_size);
+        }
         // Add segment to list of segments
-        sections.push_back(Section(section_header, elf_data, name));
+        sections.push_back(Section(section_header, data, name));
     }
     
     // Return a shared pointer to the parser
-    return std::shared_ptr<Parser>(new Parser(elf_data.size(), segments, sections));
+    return std::shared_ptr<Parser>(new Parser(std::move(mapping), segments, sections));
+}
+
+std::optional<std::shared_ptr<Parser>> Parser::Load(const std::vector<char>& elf_data)
+{
+    return Load(DataView(elf_data.data(), elf_data.size()), nullptr);
 }
 
 std::optional<std::shared_ptr<Parser>> Parser::Load(const std::filesystem::path& elfPath)
 {
-    auto size = static_cast<int32_t>(std::filesystem::file_size(elfPath));
-    std::ifstream stream;
-    stream.open(elfPath, std::ios::binary);
-    if (!stream.is_open()) {
+    auto mapping = MappedFile::Open(elfPath);
+    if (!mapping) {
         std::cerr << "Failed to open elf at " << elfPath << std::endl;
         return {};
     }
-    std::vector<char> elf_data(size);
-    stream.read(&elf_data[0], size);
-    std::cout << "Loaded " << elf_data.size() << " bytes from ELF" << std::endl;
-    return Load(elf_data);
+    std::cout << "Loaded " << mapping->data().size() << " bytes from ELF" << std::endl;
+    auto data = mapping->data();
+    return Load(data, std::move(mapping));
 }
 
 }
@@ -28,10 +28,9 @@
 #ifndef H_ELF_PARSER
 #define H_ELF_PARSER
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
-#include <fcntl.h> /* O_RDONLY */
-#include <fcntl.h>
 #include <filesystem>
 #include <iostream>
 #include <memory>
@@ -43,13 +42,57 @@
 
 namespace elfparser {
 
+// A read only run of bytes inside the ELF, standing in for
+// std::span<const char>. Views are only made once their bounds have been
+// checked against the ELF, so they never reach past its end
+class DataView {
+protected:
+    const char* m_Data;
+    size_t m_Size;
+public:
+    DataView() : m_Data(nullptr), m_Size(0) {}
+    DataView(const char* data, size_t size) : m_Data(data), m_Size(size) {}
+
+    const char* data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+
+    // Whether offset + len bytes fit inside the view
+    bool contains(size_t offset, size_t len) const {
+        return offset <= m_Size && len <= m_Size - offset;
+    }
+
+    // The bytes from offset to offset + len, or an empty view if they don't fit
+    DataView subview(size_t offset, size_t len) const {
+        return contains(offset, len) ? DataView(m_Data + offset, len) : DataView();
+    }
+};
+
+// An ELF file mapped read only into memory. Segments and sections are views
+// into it, so it lives as long as the parser does
+class MappedFile {
+protected:
+    void* m_Base;
+    size_t m_Size;
+
+    MappedFile(void* base, size_t size) : m_Base(base), m_Size(size) {}
+public:
+    static std::shared_ptr<MappedFile> Open(const std::filesystem::path& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    DataView data() const { return DataView((const char*) m_Base, m_Size); }
+};
+
 class Segment {
 protected:
     uint32_t m_Type, m_Offset, m_VirtAddr, m_PhysAddr, 
         m_FileSize, m_MemSize, m_Flags, m_Align;
-    std::vector<char> m_Data;
+    DataView m_Data;
 public:
-    Segment(const Elf32_Phdr *phdr, const std::vector<char>& elf_data) 
+    Segment(const Elf32_Phdr *phdr, DataView data) 
         : m_Type(phdr->p_type)
         , m_Offset(phdr->p_offset)
         , m_VirtAddr(phdr->p_vaddr)
@@ -58,11 +101,8 @@ public:
         , m_MemSize(phdr->p_memsz)
         , m_Flags(phdr->p_flags)
         , m_Align(phdr->p_align)
-        , m_Data()
-        {
-            auto start = &elf_data[0] + phdr->p_offset;
-            m_Data = std::vector<char>(start, start + phdr->p_filesz);
-    }
+        , m_Data(data)
+        {}
 
     uint32_t get_offset() const { return m_Offset; }
     uint32_t get_filesize() const { return m_FileSize; }
@@ -70,7 +110,14 @@ public:
     uint32_t get_physaddr() const { return m_PhysAddr; }
     uint32_t get_memsize() const { return m_MemSize; }
     uint32_t get_align() const { return m_Align; }
-    void write_data_to(char * dest, size_t len) const { memcpy(dest, &m_Data[0], len); }
+    DataView get_data() const { return m_Data; }
+    // Anything past the end of the data is zero
+    void write_data_to(char * dest, size_t len) const {
+        size_t copied = std::min(len, m_Data.size());
+        if (copied)
+            memcpy(dest, m_Data.data(), copied);
+        memset(dest + copied, 0, len - copied);
+    }
     uint32_t get_type() const { return m_Type; }
 
 };
@@ -99,10 +146,11 @@ protected:
     uint32_t m_Type, m_Flags, m_Index, m_Size, m_EntSize, 
              m_AddrAlign, m_Offset, m_Address;
     std::string m_Name;
-    std::vector<char> m_Data;
+    // Empty for SHT_NOBITS and other sections without data in the file
+    DataView m_Data;
 
 public:
-    Section( const Elf32_Shdr* shdr, const std::vector<char> elf_data, std::string name)
+    Section( const Elf32_Shdr* shdr, DataView data, std::string name)
         : m_Type(shdr->sh_type)
         , m_Flags(shdr->sh_flags)
         , m_Index(0)
@@ -112,18 +160,8 @@ public:
         , m_Offset(shdr->sh_offset)
         , m_Address(shdr->sh_addr)
         , m_Name(std::move(name))
-        , m_Data()
-        {
-            auto start = elf_data.begin() + m_Offset;
-            switch(m_Type) {
-                case SHT_PROGBITS:
-                    m_Data = std::vector<char>(start, start + m_Size);
-                    break;
-                case SHT_NOBITS:
-                    m_Data = std::vector<char>(m_Size);
-                    break;
-            }
-    }
+        , m_Data(data)
+        {}
 
     std::string get_name() const { return m_Name; }
     uint32_t get_flags() const { return m_Flags; }
@@ -132,7 +170,14 @@ public:
     uint32_t get_size() const { return m_Size; }
     uint32_t get_entsize() const { return m_EntSize; }
     uint32_t get_alignment() const { return m_AddrAlign; }
-    void write_data_to(char * dest, size_t len) const { memcpy(dest, &m_Data[0], len); }
+    DataView get_data() const { return m_Data; }
+    // Anything past the end of the data (all of a .bss) is zero
+    void write_data_to(char * dest, size_t len) const {
+        size_t copied = std::min(len, m_Data.size());
+        if (copied)
+            memcpy(dest, m_Data.data(), copied);
+        memset(dest + copied, 0, len - copied);
+    }
     SectionType get_type() const { return (SectionType) m_Type;}
 };
 
@@ -143,18 +188,33 @@ private:
     std::vector<Segment> m_Segments;
     std::vector<Section> m_Sections;
 
+    // The binary made by fill_bin, and where it would end with all of .bss
+    size_t m_Start = 0, m_End = 0, m_MemoryEnd = 0;
+
+    // Keeps the mapping the segments and sections point into alive, null
+    // when the ELF was loaded from memory
+    std::shared_ptr<MappedFile> m_Mapping;
+
+    static std::optional<std::shared_ptr<Parser>> Load(DataView elf_data, std::shared_ptr<MappedFile> mapping);
+
 public:
-    // Load ELF from std::vector<char>
+    // Load ELF from std::vector<char>. The parser points into elfData, so it
+    // has to outlive the parser
     static std::optional<std::shared_ptr<Parser>> Load(const std::vector<char>& elfData);
 
-    // Load ELF from Path
+    // Load ELF from Path, by mapping it into memory
     static std::optional<std::shared_ptr<Parser>> Load(const std::filesystem::path& elfData);
 
-    bool fill_bin(std::vector<char>& bin_data);
+    // With trim_bss, the binary ends at the last byte from the file rather
+    // than the end of the last segment in memory
+    bool fill_bin(std::vector<char>& bin_data, bool trim_bss = false);
+
+    // Breaks the binary from fill_bin down by segment and section
+    void print_size_report(std::ostream& out) const;
 
 protected:
-    inline Parser(size_t elf_size, std::vector<Segment> segments, std::vector<Section> sections)
-        : m_Segments(std::move(segments)), m_Sections(std::move(sections)) {};
+    inline Parser(std::shared_ptr<MappedFile> mapping, std::vector<Segment> segments, std::vector<Section> sections)
+        : m_Segments(std::move(segments)), m_Sections(std::move(sections)), m_Mapping(std::move(mapping)) {};
 };
 
 } // namespace elfparser
@@ -0,0 +1,247 @@
+/* Custom IsoStream implementations. These have to live in C as the public
+ * struct iso_stream has a member named "class". */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "iso_streams.h"
+
+typedef struct {
+    off_t size;
+    off_t offset; /* -1 if stream closed */
+    ino_t ino_id;
+} ZeroStreamData;
+
+static int zero_open(IsoStream* stream) {
+    ZeroStreamData* data = (ZeroStreamData*) stream->data;
+    if(data->offset != -1) {
+        return ISO_FILE_ALREADY_OPENED;
+    }
+    data->offset = 0;
+    return ISO_SUCCESS;
+}
+
+static int zero_close(IsoStream* stream) {
+    ZeroStreamData* data = (ZeroStreamData*) stream->data;
+    if(data->offset == -1) {
+        return ISO_FILE_NOT_OPENED;
+    }
+    data->offset = -1;
+    return ISO_SUCCESS;
+}
+
+static off_t zero_get_size(IsoStream* stream) {
+    return ((ZeroStreamData*) stream->data)->size;
+}
+
+static int zero_read(IsoStream* stream, void* buf, size_t count) {
+    ZeroStreamData* data = (ZeroStreamData*) stream->data;
+    if(buf == NULL) {
+        return ISO_NULL_POINTER;
+    }
+
+    if(count == 0) {
+        return ISO_WRONG_ARG_VALUE;
+    }
+
+    if(data->offset == -1) {
+        return ISO_FILE_NOT_OPENED;
+    }
+
+    off_t remaining = data->size - data->offset;
+    if(remaining <= 0) {
+        return 0; /* EOF */
+    }
+
+    size_t len = ((off_t) count < remaining) ? count : (size_t) remaining;
+    memset(buf, 0, len);
+    data->offset += len;
+    return (int) len;
+}
+
+static int zero_is_repeatable(IsoStream* stream) {
+    (void) stream;
+    return 1;
+}
+
+static void zero_get_id(IsoStream* stream, unsigned int* fs_id, dev_t* dev_id, ino_t* ino_id) {
+    *fs_id = 0;
+    *dev_id = 0;
+    *ino_id = ((ZeroStreamData*) stream->data)->ino_id;
+}
+
+static void zero_free(IsoStream* stream) {
+    free(stream->data);
+}
+
+static int zero_update_size(IsoStream* stream) {
+    (void) stream;
+    return ISO_SUCCESS;
+}
+
+static IsoStream* zero_get_input_stream(IsoStream* stream, int flag) {
+    (void) stream;
+    (void) flag;
+    return NULL;
+}
+
+static int zero_clone_stream(IsoStream* old_stream, IsoStream** new_stream, int flag) {
+    if(flag) {
+        return ISO_STREAM_NO_CLONE;
+    }
+
+    return iso_zero_stream_new(zero_get_size(old_stream), new_stream);
+}
+
+static IsoStreamIface zero_stream_class = {
+    4, /* version */
+    "zero",
+    zero_open,
+    zero_close,
+    zero_get_size,
+    zero_read,
+    zero_is_repeatable,
+    zero_get_id,
+    zero_free,
+    zero_update_size,
+    zero_get_input_stream,
+    NULL,
+    zero_clone_stream
+};
+
+int iso_zero_stream_new(off_t size, IsoStream** stream) {
+    if(stream == NULL) {
+        return ISO_NULL_POINTER;
+    }
+
+    IsoStream* str = (IsoStream*) malloc(sizeof(IsoStream));
+    ZeroStreamData* data = (ZeroStreamData*) malloc(sizeof(ZeroStreamData));
+    if(!str || !data) {
+        free(str);
+        free(data);
+        return ISO_OUT_OF_MEM;
+    }
+
+    data->size = size;
+    data->offset = -1;
+    data->ino_id = serial_id++;
+
+    str->refcount = 1;
+    str->data = data;
+    str->class = &zero_stream_class;
+
+    *stream = str;
+    return ISO_SUCCESS;
+}
+
+int iso_zero_stream_set_size(IsoStream* stream, off_t size) {
+    if(stream == NULL) {
+        return ISO_NULL_POINTER;
+    }
+
+    if(stream->class != &zero_stream_class || size < 0) {
+        return ISO_WRONG_ARG_VALUE;
+    }
+
+    ZeroStreamData* data = (ZeroStreamData*) stream->data;
+    if(data->offset != -1) {
+        return ISO_FILE_ALREADY_OPENED;
+    }
+
+    data->size = size;
+    return ISO_SUCCESS;
+}
+
+/* Tagged streams share the zero stream's bookkeeping, and only differ in
+ * what they read */
+typedef struct {
+    ZeroStreamData zero;
+    uint8_t tag[ISO_STREAM_TAG_SIZE];
+} TaggedStreamData;
+
+#define TAGGED_BLOCK_SIZE 2048
+
+static int tagged_read(IsoStream* stream, void* buf, size_t count) {
+    TaggedStreamData* data = (TaggedStreamData*) stream->data;
+    off_t start = data->zero.offset;
+
+    int len = zero_read(stream, buf, count);
+    if(len <= 0) {
+        return len;
+    }
+
+    /* Fill in the part of each block's header that falls in what was read */
+    off_t end = start + len;
+    for(off_t block = start / TAGGED_BLOCK_SIZE; block * TAGGED_BLOCK_SIZE < end; ++block) {
+        uint8_t header[ISO_STREAM_TAG_SIZE + 4];
+        memcpy(header, data->tag, ISO_STREAM_TAG_SIZE);
+        header[ISO_STREAM_TAG_SIZE + 0] = (uint8_t) block;
+        header[ISO_STREAM_TAG_SIZE + 1] = (uint8_t) (block >> 8);
+        header[ISO_STREAM_TAG_SIZE + 2] = (uint8_t) (block >> 16);
+        header[ISO_STREAM_TAG_SIZE + 3] = (uint8_t) (block >> 24);
+
+        off_t header_start = block * TAGGED_BLOCK_SIZE;
+        off_t from = (header_start > start) ? header_start : start;
+        off_t to = header_start + (off_t) sizeof(header);
+        if(to > end) {
+            to = end;
+        }
+
+        if(from < to) {
+            memcpy((uint8_t*) buf + (from - start), header + (from - header_start), (size_t) (to - from));
+        }
+    }
+
+    return len;
+}
+
+static int tagged_clone_stream(IsoStream* old_stream, IsoStream** new_stream, int flag) {
+    if(flag) {
+        return ISO_STREAM_NO_CLONE;
+    }
+
+    TaggedStreamData* data = (TaggedStreamData*) old_stream->data;
+    return iso_tagged_stream_new(data->zero.size, data->tag, new_stream);
+}
+
+static IsoStreamIface tagged_stream_class = {
+    4, /* version */
+    "tagd",
+    zero_open,
+    zero_close,
+    zero_get_size,
+    tagged_read,
+    zero_is_repeatable,
+    zero_get_id,
+    zero_free,
+    zero_update_size,
+    zero_get_input_stream,
+    NULL,
+    tagged_clone_stream
+};
+
+int iso_tagged_stream_new(off_t size, const uint8_t tag[ISO_STREAM_TAG_SIZE], IsoStream** stream) {
+    if(stream == NULL || tag == NULL) {
+        return ISO_NULL_POINTER;
+    }
+
+    IsoStream* str = (IsoStream*) malloc(sizeof(IsoStream));
+    TaggedStreamData* data = (TaggedStreamData*) malloc(sizeof(TaggedStreamData));
+    if(!str || !data) {
+        free(str);
+        free(data);
+        return ISO_OUT_OF_MEM;
+    }
+
+    data->zero.size = size;
+    data->zero.offset = -1;
+    data->zero.ino_id = serial_id++;
+    memcpy(data->tag, tag, ISO_STREAM_TAG_SIZE);
+
+    str->refcount = 1;
+    str->data = data;
+    str->class = &tagged_stream_class;
+
+    *stream = str;
+    return ISO_SUCCESS;
+}
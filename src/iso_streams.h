@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define LIBISOFS_WITHOUT_LIBBURN yes
+#include <libisofs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Creates a stream of `size` zero bytes. Nothing is allocated for the
+ * contents, reads just clear the caller's buffer. */
+int iso_zero_stream_new(off_t size, IsoStream** stream);
+
+/* Resizes a closed stream created by iso_zero_stream_new. This allows the
+ * size to be decided after the image layout has been computed. */
+int iso_zero_stream_set_size(IsoStream* stream, off_t size);
+
+/* Length of the tag passed to iso_tagged_stream_new */
+#define ISO_STREAM_TAG_SIZE 24
+
+/* Creates a stream of `size` bytes in 2048 byte blocks. Each block starts
+ * with the tag, then the block's number as a 32 bit little endian value, and
+ * is zero after that. The tags show where libisofs put the file when the
+ * image is written, which isn't otherwise available for new files. */
+int iso_tagged_stream_new(off_t size, const uint8_t tag[ISO_STREAM_TAG_SIZE], IsoStream** stream);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,6 +1,7 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <vector>
 #include <iostream>
@@ -9,13 +10,20 @@
 #include <algorithm>
 #include <filesystem>
 #include <sstream>
-#include <random>
 #include <optional>
 #include <fstream>
 #include <thread>
+#include <chrono>
 #include <cstring>
 #include <iterator>
 #include <climits>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #define LIBISOFS_WITHOUT_LIBBURN yes
 #include <libisofs.h>
@@ -27,6 +35,11 @@
 
 #include "scramble.h"
 #include "elf_parser.hpp"
+#include "iso_streams.h"
+#include "trace.h"
+#include "memory_usage.h"
+#include "wav.h"
+#include "xa_files.h"
 
 #ifdef _WIN32
 #define PATH_TO_CSTR(p) (p).string().c_str()
@@ -54,11 +67,15 @@ const std::vector<std::tuple<std::string, std::string, std::string, ArgType>> CO
     {"-D", "--directory-contents", "directory whose contents should be included (recursively) in the data track. Repeat for multiple directories", ARG_TYPE_NAMED_OPTIONAL},
     {"-e", "--elf", "executable file to use as 1ST_READ.BIN", ARG_TYPE_NAMED_OPTIONAL},
     {"-f", "--file", "file to include in the data track. Repeat for multiple files", ARG_TYPE_NAMED_OPTIONAL},
+    {"-F", "--form2-file", "path to a list of files or directories in the data track, in the sort file's format, to store as Mode 2 Form 2 sectors", ARG_TYPE_NAMED_OPTIONAL},
     {"-h", "--help", "this help screen", ARG_TYPE_FLAG_OPTIONAL},
     {"-i", "--image", "path to a suitable MR format image for the license screen", ARG_TYPE_NAMED_OPTIONAL},
+    {"-j", "--jobs", "scramble the boot binary and encode the data track on this many threads. The image is the same whatever the number", ARG_TYPE_NAMED_OPTIONAL},
     {"-m", "--no-mr", "disable the default MR boot image", ARG_TYPE_FLAG_OPTIONAL},
+    {"-M", "--max-memory", "try to keep memory use below this many MB, by streaming audio tracks and using smaller buffers", ARG_TYPE_NAMED_OPTIONAL},
     {"-I", "--dump-iso", "if specified, the data track will be written to a .iso alongside the .cdi", ARG_TYPE_FLAG_OPTIONAL},
     {"-o", "--output", "output filename", ARG_TYPE_NAMED_REQUIRED},
+    {"-O", "--direct-io", "write the .cdi with O_DIRECT, bypassing the page cache (Linux only)", ARG_TYPE_FLAG_OPTIONAL},
     {"-n", "--name", "name of the game (must be fewer than 128 characters)", ARG_TYPE_NAMED_OPTIONAL},
     {"-N", "--no-padding", "specify to disable padding of the data track", ARG_TYPE_FLAG_OPTIONAL},
     {"-p", "--ipbin", "ip.bin file to use instead of the default one", ARG_TYPE_NAMED_OPTIONAL},
@@ -66,7 +83,11 @@ const std::vector<std::tuple<std::string, std::string, std::string, ArgType>> CO
     {"-r", "--release", "release date in YYYYMMDD format", ARG_TYPE_NAMED_OPTIONAL},
     {"-s", "--serial", "disk serial number", ARG_TYPE_NAMED_OPTIONAL},
     {"-S", "--sort-file", "path to sort file", ARG_TYPE_NAMED_OPTIONAL},
-    {"-v", "--verbosity", "a number between 0 and 3, 0 == no output", ARG_TYPE_NAMED_OPTIONAL}
+    {"-t", "--trace", "write the time spent in each stage to a Chrome trace event (.json) file", ARG_TYPE_NAMED_OPTIONAL},
+    {"-T", "--trim-bss", "end 1ST_READ.BIN at the last byte stored in the ELF, leaving trailing .bss to the program's startup code to clear", ARG_TYPE_FLAG_OPTIONAL},
+    {"-v", "--verbosity", "a number between 0 and 3, 0 == no output", ARG_TYPE_NAMED_OPTIONAL},
+    {"-V", "--verify-scramble", "self-test the scrambler by descrambling the boot binary and scrambling it again. Given -B and -e or -b, also check that the -B binary descrambles to the same program", ARG_TYPE_FLAG_OPTIONAL},
+    {"-X", "--xa-interleave", "path to an interleave description, building one real-time XA stream file in the data track. Repeat for multiple files", ARG_TYPE_NAMED_OPTIONAL}
 };
 
 static int verbosity() {
@@ -78,6 +99,12 @@ static int verbosity() {
     return std::stoi(level);
 }
 
+/* Threads encoding the data track and scrambling the boot binary, checked
+ * to be a number in main() */
+static std::size_t jobs() {
+    return (OPTS.count("jobs")) ? std::stoul(OPTS["jobs"][0]) : 1;
+}
+
 
 const char* HELP_TEXT_PREAMBLE = R"(
 Usage: mkdcdisc [OPTION]... -e [EXECUTABLE] -o [OUTPUT]
@@ -177,48 +204,6 @@ std::map<std::string, std::vector<std::string>> parse_options(int argc, char* ar
     return opts;
 }
 
-static std::optional<std::filesystem::path> generate_temporary_directory() {
-    auto temp_dir = std::filesystem::temp_directory_path();
-    std::random_device dev;
-    std::mt19937 prng(dev());
-    std::uniform_int_distribution<uint64_t> rand(0);
-    std::filesystem::path path;
-
-    std::stringstream ss;
-    ss << std::hex << rand(prng);
-    path = temp_dir / ss.str();
-    if(std::filesystem::create_directory(path)) {
-        if(verbosity() > 2) {
-            std::cout << "Created temporary directory at: " << path << std::endl;
-        }
-        return path;
-    } else {
-        return std::optional<std::filesystem::path>();
-    }
-}
-
-void destroy_temp_directory(const std::filesystem::path& path) {
-    /* Resolve and normalize paths to handle symbolic links */
-    auto temp_dir_path = std::filesystem::canonical(std::filesystem::temp_directory_path());
-    auto provided_path_parent = std::filesystem::canonical(path.parent_path());
-
-    if(verbosity() > 2) {
-        std::cout << "Checking paths:" << std::endl;
-        std::cout << "  System temp dir: " << temp_dir_path << std::endl;
-        std::cout << "  Provided dir's parent: " << provided_path_parent << std::endl;
-    }
-
-    /* Ensure the provided path is within the system's temp directory */
-    if(provided_path_parent == temp_dir_path) {
-        if(verbosity() > 2) {
-            std::cout << "Removing temporary directory at: " << path << std::endl;
-        }
-        std::filesystem::remove_all(path);
-    } else {
-        std::cerr<< "Failed to remove temporary directory at : " << path << std::endl;
-    }
-}
-
 bool load_elf_file(const std::filesystem::path& elf_name, std::vector<char>& bin_data) {
     if(!std::filesystem::exists(elf_name)) {
         std::cerr << "ELF file does not exist: " << elf_name << std::endl;
@@ -237,11 +222,15 @@ bool load_elf_file(const std::filesystem::path& elf_name, std::vector<char>& bin
     auto elf_parser = elf_parser_ret.value();
     
     // Create BIN from  ELF
-    if ( !elf_parser->fill_bin(bin_data)) {
+    if ( !elf_parser->fill_bin(bin_data, OPTS.count("trim-bss"))) {
         std::cerr << "Failed to create BIN" << std::endl;
         return false;
     }
 
+    if(verbosity() > 1) {
+        elf_parser->print_size_report(std::cout);
+    }
+
     return true;
 }
 
@@ -277,105 +266,98 @@ bool load_bin_file(const std::filesystem::path& bin_path, std::vector<char>& bin
     return true;
 }
 
-static bool gather_files(const std::filesystem::path& out) {
+/* Loads the boot binary and scrambles it if needed. It stays in memory until
+ * it is added to the ISO, nothing is written to disk */
+static bool gather_files(std::vector<char>& scrambled_data) {
+    TraceScope trace("gather_files");
+
     if(verbosity() > 1) {
-        std::cout << "Gathering files from specified directories" << std::endl;
+        std::cout << "Preparing 1ST_READ.BIN" << std::endl;
     }
 
-    std::vector<char> bin_data;
-    std::vector<char> scrambled_data;
     bool needs_scrambling = true;
 
+    trace_begin("load_binary");
     if(OPTS.count("elf")) {
-        load_elf_file(OPTS["elf"][0], bin_data);
+        load_elf_file(OPTS["elf"][0], scrambled_data);
     } else if (OPTS.count("unscrambled-binary")) {
-        load_bin_file(OPTS["unscrambled-binary"][0], bin_data);
+        load_bin_file(OPTS["unscrambled-binary"][0], scrambled_data);
     } else {
-        load_bin_file(OPTS["scrambled-binary"][0], bin_data);
+        load_bin_file(OPTS["scrambled-binary"][0], scrambled_data);
         needs_scrambling = false;
     }
+    trace_end("load_binary");
+    trace_counter("boot_bin_bytes", scrambled_data.size());
 
-    if (!bin_data.size()) {
+    if (!scrambled_data.size()) {
         std::cerr << "No bin data available, aborting..." << std::endl;
         return false;
     }
 
     if(verbosity() > 2) {
-        std::cout << "Bin size: " << bin_data.size() << std::endl;
+        std::cout << "Bin size: " << scrambled_data.size() << std::endl;
+    }
+
+    /* Both ways are done in place, so checking them needs hashes rather than
+     * a second copy of the binary */
+    bool verify = OPTS.count("verify-scramble");
+    auto hash_bin = [&]() {
+        return std::hash<std::string_view>()(std::string_view(scrambled_data.data(), scrambled_data.size()));
+    };
+
+    std::size_t unscrambled_hash = 0;
+    if (verify && needs_scrambling) {
+        unscrambled_hash = hash_bin();
     }
 
     // Scramble BIN
     if (needs_scrambling) {
-        scrambled_data = scramble(bin_data);
+        TraceScope trace_scramble("scramble");
+        scramble(scrambled_data, (unsigned int) jobs());
         if(verbosity() > 2) {
             std::cout << "Bin Scrambled!" << std::endl;
         }
-    } else {
-        scrambled_data.resize(bin_data.size());
-        memcpy(&scrambled_data[0], &bin_data[0], bin_data.size());
     }
 
-    std::filesystem::path scrambled_path = out / "1ST_READ.BIN";
+    if (verify) {
+        TraceScope trace_verify("verify_scramble");
+        std::size_t scrambled_hash = hash_bin();
 
-    std::ofstream output_stream;
-    output_stream.open(scrambled_path, std::ios::binary);
-    if (!output_stream.is_open())
-    {
-        std::cerr << "Failed to open " << scrambled_path << std::endl;
-        return false;
-    }
-    output_stream.write(&scrambled_data[0], scrambled_data.size());
-    output_stream.close();
+        descramble(scrambled_data, (unsigned int) jobs());
+        bool descrambled = !needs_scrambling || hash_bin() == unscrambled_hash;
 
-    if(verbosity() > 2) {
-        std::cout << "Saved to " << scrambled_path << std::endl;
-    }
-    
-    if(OPTS.count("directory")) {
-        for(std::filesystem::path dir: OPTS["directory"]) {
-            if(std::filesystem::exists(dir)) {
-                std::filesystem::copy(dir, out / dir.stem(), std::filesystem::copy_options::recursive);
-            } else {
-                std::cerr << "No such directory: " << dir.string() << std::endl;
-                return false;
-            }
+        scramble(scrambled_data, (unsigned int) jobs());
+        if (!descrambled || hash_bin() != scrambled_hash) {
+            std::cerr << "1ST_READ.BIN didn't survive descrambling and scrambling again, aborting..." << std::endl;
+            return false;
         }
-    }
 
-    if(OPTS.count("directory-contents")) {
-        for(std::filesystem::path dir: OPTS["directory-contents"]) {
-            if(std::filesystem::exists(dir)) {
-                for (const auto & entry : std::filesystem::directory_iterator(dir)) {
-                    if (entry.path().filename() != "1ST_READ.BIN") {
-                        if (verbosity() > 2) {
-                            std::cout << "Adding file: " << entry.path().filename() << std::endl;
-                        }
-                        std::filesystem::copy(entry, out / entry.path().filename(), std::filesystem::copy_options::recursive);
-                    } else {
-                        if (verbosity() > 2) {
-                            std::cout << "Skipping 1ST_READ.BIN as we are generating a new one" << std::endl;
-                        }
-                    }
-                }
-            } else {
-                std::cerr << "No such directory: " << dir.string() << std::endl;
-                return false;
-            }
+        if(verbosity() > 1) {
+            std::cout << "Scrambled 1ST_READ.BIN verified" << std::endl;
         }
     }
 
-    if(OPTS.count("file")) {
-        for(std::filesystem::path file: OPTS["file"]) {
-            if(std::filesystem::exists(file)) {
-                if(verbosity() > 2) {
-                    std::cout << file << " -> " << out / file.filename() << std::endl;
-                }
+    /* The round trip above only tests the scrambler, it can't tell whether
+     * a prescrambled binary is any good. Given the program it was made
+     * from, check that it descrambles back to that */
+    if (verify && needs_scrambling && OPTS.count("scrambled-binary")) {
+        TraceScope trace_verify("verify_prescrambled");
 
-                std::filesystem::copy(file, out / file.filename());
-            } else {
-                std::cerr << "No such file: " << file.string() << std::endl;
-                return false;
-            }
+        std::vector<char> prescrambled;
+        if (!load_bin_file(OPTS["scrambled-binary"][0], prescrambled)) {
+            return false;
+        }
+
+        descramble(prescrambled, (unsigned int) jobs());
+        std::size_t prescrambled_hash = std::hash<std::string_view>()(std::string_view(prescrambled.data(), prescrambled.size()));
+        if (prescrambled.size() != scrambled_data.size() || prescrambled_hash != unscrambled_hash) {
+            std::cerr << OPTS["scrambled-binary"][0] << " doesn't descramble to the same program as "
+                      << OPTS[(OPTS.count("elf")) ? "elf" : "unscrambled-binary"][0] << ", aborting..." << std::endl;
+            return false;
+        }
+
+        if(verbosity() > 1) {
+            std::cout << "Prescrambled 1ST_READ.BIN verified" << std::endl;
         }
     }
 
@@ -404,11 +386,12 @@ struct IPBin {
     char bootstrap2[8192];
 };
 
-static std::string generate_product_number(const std::vector<uint8_t>& data) {
+static std::string generate_product_number(const std::vector<char>& data) {
     const std::string prefix = "IND-";
-    const std::string raw(data.begin(), data.end());
 
-    auto hash = std::hash<std::string>()(raw);
+    /* Hashed in place, std::hash<std::string_view> gives the same result as
+     * hashing a std::string copy of the data */
+    auto hash = std::hash<std::string_view>()(std::string_view(data.data(), data.size()));
     return prefix + std::to_string(hash).substr(0, 6);
 }
 
@@ -449,16 +432,7 @@ bool load_ip_bin(const std::filesystem::path& ipbin_path, IPBin* out) {
     return true;
 }
 
-bool generate_ip_bin(const std::filesystem::path& output_dir, const std::filesystem::path& bin_path, IPBin* out) {
-    std::ifstream bin(bin_path.string());
-    bin.seekg(0, std::ios::end);
-    auto size = bin.tellg();
-    std::vector<uint8_t> bin_data;
-    bin_data.resize(size);
-    bin.seekg(0, std::ios::beg);
-    bin.read((char*) &bin_data[0], size);
-    bin.close();
-
+bool generate_ip_bin(const std::vector<char>& bin_data, IPBin* out) {
     IPBin ip_bin;
     uint8_t* mr_image = ((uint8_t*) &ip_bin) + 0x3820;
 
@@ -547,110 +521,126 @@ bool generate_ip_bin(const std::filesystem::path& output_dir, const std::filesys
     return true;
 }
 
-std::optional<std::vector<uint8_t>> wav_to_cdda(const std::string& filename) {
-    std::vector<uint8_t> data;
+/* Reads the samples into memory. Anything missing from the end of the file
+ * is left as silence. */
+static cd_track_source_t* load_wav_data(const std::string& filename, const WavData& wav) {
+    uint8_t* data = (uint8_t*) calloc(wav.length, 1);
+    read_wav_data(filename, wav, data);
+    return cd_track_source_adopt_buffer(data, wav.length);
+}
 
-    std::ifstream file(filename, std::ios::binary);
-    if(!file.good()) {
-        std::cerr << "Couldn't load .wav file: " << filename << std::endl;
-        return std::optional<std::vector<uint8_t>>();
+/* Reads the samples from the file as the track is written. The fd must stay
+ * open until then */
+static cd_track_source_t* stream_wav_data(const std::string& filename, const WavData& wav, int* fd) {
+#ifdef _WIN32
+    *fd = _open(filename.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    *fd = open(filename.c_str(), O_RDONLY);
+#endif
+    if(*fd < 0) {
+        std::cerr << "Couldn't open .wav file: " << filename << std::endl;
+        return NULL;
     }
 
-    char buffer[4];
+    return cd_track_source_from_fd(*fd, wav.offset, wav.length);
+}
+
+static void close_fd(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
 
-    file.read(buffer, 4);
-    if(std::strncmp(buffer, "RIFF", 4) != 0) {
-        std::cerr << "Not a valid .wav file: " << filename << std::endl;
-        return std::optional<std::vector<uint8_t>>();
+/* File descriptors that track sources read from. They're closed once the
+ * image is written, or on the way out of any early return */
+class OpenFds {
+public:
+    ~OpenFds() {
+        close_all();
     }
 
-    file.seekg(4, std::ios_base::cur); // file length
-    file.read(buffer, 4);
+    void add(int fd) {
+        m_Fds.push_back(fd);
+    }
 
-    if(std::strncmp(buffer, "WAVE", 4) != 0) {
-        std::cerr << "Not a valid .wav file: " << filename << std::endl;
-        return std::optional<std::vector<uint8_t>>();
+    void close_all() {
+        for(int fd: m_Fds) {
+            close_fd(fd);
+        }
+        m_Fds.clear();
     }
 
-    while(!file.eof()) {
-        file.read(buffer, 4);  // Chunk id
+private:
+    std::vector<int> m_Fds;
+};
 
-        if (verbosity() > 2) {
-            std::cout << "Chunk ID is " << buffer[0] << buffer[1] << buffer[2] << buffer[3] << std::endl;
-        }
+/* --max-memory in bytes, 0 if there isn't a budget. Checked and set by main() */
+static std::size_t MEMORY_BUDGET = 0;
 
-        if(std::strncmp(buffer, "fmt ", 4) == 0) {
-
-            /* Check the format */
-            struct Format {
-                uint32_t length;
-                uint16_t type;
-                uint16_t channels;
-                uint32_t frequency;
-                uint32_t rate;
-                uint16_t bytes_per_sample;
-                uint16_t bitrate;
-            } format;
-
-            file.read((char*) &format, sizeof(format));
-
-            if (verbosity() > 2) {
-                std::cout << std::dec;
-                std::cout << "  Length is " << format.length << std::endl;
-                std::cout << "  Channels is " << format.channels << std::endl;
-                std::cout << "  Frequency is " << format.frequency << std::endl;
-            }
+/* Buffer sizes and code paths, chosen to fit within --max-memory */
+struct MemoryPlan {
+    std::size_t budget = 0;                       /* 0 if there isn't one */
+    std::size_t batch_sectors = 512;              /* Disc image writer batches */
+    std::size_t fifo_blocks = 1024;               /* libisofs ring buffer */
+    std::size_t cdda_memory_limit = SIZE_MAX;     /* Audio loaded whole up to this total */
+};
 
-            if(format.frequency != 44100 || format.channels != 2 || format.bitrate != 16) {
-                std::cerr << "Unsupported .wav format. Must be stereo, 44100hz, and 16 bit samples.: " << filename << std::endl;
-                return std::optional<std::vector<uint8_t>>();
-            }
+static MemoryPlan plan_memory() {
+    MemoryPlan plan;
+    if(!MEMORY_BUDGET) {
+        return plan;
+    }
 
-        } else if(std::strncmp(buffer, "data", 4) == 0) {
+    plan.budget = MEMORY_BUDGET;
 
-            if (verbosity() > 2) {
-                std::cout << "  Data chunk" << std::endl;
-            }
+    std::size_t in_use = memory_current_rss();
+    std::size_t available = (plan.budget > in_use) ? plan.budget - in_use : 0;
 
-            /* Read the data */
-            uint32_t length;
-            file.read((char*) &length, sizeof(length));
-            data.resize(length);
-            file.read((char*) &data[0], length);
-            break;
+    /* A quarter each for the writer batches (input plus encoded output, and
+     * the output buffer of four batches) and the libisofs ring buffer, the
+     * rest for audio tracks. With --jobs each thread has two batches */
+    const std::size_t batch_count = (jobs() > 1) ? jobs() * 2 : 1;
+    const std::size_t bytes_per_batch_sector = batch_count * (2048 + 2352) + 4 * 2352;
+    plan.batch_sectors = std::clamp<std::size_t>(available / 4 / bytes_per_batch_sector, 16, 512);
+    plan.fifo_blocks = std::clamp<std::size_t>(available / 4 / 2048, 32, 1024);
+    plan.cdda_memory_limit = available / 2;
 
-        } else {
-            uint32_t skip;
-            file.read((char*) &skip, sizeof(skip));
-            file.seekg(skip, std::ios_base::cur);
+    if(!available) {
+        std::cerr << "Warning: " << memory_current_rss() / (1024 * 1024) << "MB is already in use, "
+                  << "using the smallest buffers possible" << std::endl;
+    }
 
-            if (verbosity() > 2) {
-                std::cout << "  Skipped " << skip << " bytes" << std::endl;
-            }
-            continue;
-        }
+    if(verbosity() > 1) {
+        std::cout << "Memory budget: " << plan.batch_sectors << " sector batches, "
+                  << plan.fifo_blocks * 2 << "KB ISO buffer, up to "
+                  << plan.cdda_memory_limit / (1024 * 1024) << "MB of audio in memory" << std::endl;
     }
 
-    return data;
+    return plan;
 }
 
-static size_t estimate_padding_sectors(const cd_image_t* image_so_far, const std::filesystem::path& data_dir) {
-    auto dir_size = [](const std::filesystem::path& dir) -> std::size_t {
-        std::size_t size{ 0 };
-        for(const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
-            if(entry.is_regular_file() && !entry.is_symlink()) {
-                size += entry.file_size();
-            }
-        }
-        return size;
-    };
+/* Runs the libisofs layout pass without writing anything and returns the
+ * exact size of the image in bytes, or -1 on failure */
+static off_t compute_iso_size(IsoImage* iso, IsoWriteOpts* opts) {
+    TraceScope trace("iso_layout");
+    struct burn_source* burn_src = NULL;
+
+    iso_write_opts_set_will_cancel(opts, 1);
+    int ret = iso_image_create_burn_source(iso, opts, &burn_src);
+    iso_write_opts_set_will_cancel(opts, 0);
 
-    const std::size_t iso_padding = 10 * 1024 * 1024;  /* 10M for ISO structures */
-    std::size_t used = cd_image_length_in_sectors(image_so_far);
-    used += dir_size(data_dir) / 2048;
-    used += iso_padding / 2048;
+    if(ret < 0) {
+        std::cerr << "Unable to compute the ISO layout: " << iso_error_to_msg(ret) << std::endl;
+        return -1;
+    }
 
-    return std::max(333000 - int32_t(used), 0);
+    off_t size = burn_src->get_size(burn_src);
+    burn_src->cancel(burn_src);
+    burn_src->free_data(burn_src);
+    free(burn_src);
+    return size;
 }
 
 static void print_node_info(IsoNode *node, int depth) {
@@ -760,11 +750,6 @@ static void traverse_and_set_weights(
         std::string current_name(name);
         std::string child_full_path = construct_path(parent_dirs, current_name);
 
-        /* Make sure we give the special 0.0 file at the root the most weight */
-        if(!OPTS.count("no-padding") && current_name == "0.0") {
-            iso_node_set_sort_weight(node, INT_MAX);
-        }
-
         /* Check if the node has a specific weight */
         auto child_it = SORT_WEIGHTS.find(child_full_path);
         if(child_it != SORT_WEIGHTS.end()) {
@@ -824,7 +809,427 @@ static bool parse_sort_file(const std::string &file_path) {
     return !SORT_WEIGHTS.empty();
 }
 
-bool build_cdi(const std::filesystem::path& input_dir) {
+/* Paths in the data track whose files are stored as Form 2. A rule names a
+ * file, or a directory for everything under it */
+static std::vector<std::string> FORM2_RULES;
+
+static bool parse_form2_file(const std::string &file_path) {
+    std::ifstream file(file_path);
+
+    if(!file.is_open()) {
+        std::cerr << "Could not open Form 2 file list: " << file_path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while(std::getline(file, line)) {
+        /* Skip empty lines or lines starting with a comment (#) */
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        /* Anything after the path, like a sort weight, is ignored */
+        std::istringstream iss(line);
+        std::string path;
+        if(iss >> path) {
+            FORM2_RULES.push_back(path);
+        }
+    }
+
+    return true;
+}
+
+static bool matches_form2_rule(const std::string &path) {
+    for(const auto &rule : FORM2_RULES) {
+        if(path == rule || rule == "/" ||
+           (path.size() > rule.size() && path.compare(0, rule.size(), rule) == 0 && path[rule.size()] == '/')) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void find_form2_nodes(IsoDir *dir, const std::vector<std::string> &parent_dirs,
+                             std::vector<std::pair<IsoNode*, std::string>> &found) {
+    IsoNode *node;
+    IsoDirIter *iter;
+
+    if(iso_dir_get_children(dir, &iter) < 0) {
+        return;
+    }
+
+    while(iso_dir_iter_next(iter, &node) == 1) {
+        std::string name = iso_node_get_name(node);
+        std::string path = construct_path(parent_dirs, name);
+
+        if(iso_node_get_type(node) == LIBISO_DIR) {
+            auto updated_parent_dirs = parent_dirs;
+            updated_parent_dirs.push_back(name);
+            find_form2_nodes((IsoDir*) node, updated_parent_dirs, found);
+        } else if(iso_node_get_type(node) == LIBISO_FILE && matches_form2_rule(path)) {
+            found.emplace_back(node, path);
+        }
+    }
+
+    iso_dir_iter_free(iter);
+}
+
+/* Replaces the file with a placeholder for its Form 2 sectors, keeping its
+ * attributes */
+static bool store_as_form2(IsoImage *iso, IsoNode *node, const std::string &iso_path, XaFiles &xa_files) {
+    IsoStream *stream = iso_file_get_stream((IsoFile*) node);
+    char *source = iso_stream_get_source_path(stream, 0);
+    if(!source) {
+        std::cerr << "Unable to store " << iso_path << " as Form 2, it doesn't come from a file" << std::endl;
+        return false;
+    }
+
+    std::size_t index = xa_files.add_form2_file(iso_path, source, std::size_t(iso_stream_get_size(stream)));
+    free(source);
+
+    IsoStream *placeholder = NULL;
+    int ret = xa_files.new_placeholder(index, &placeholder);
+    if(ret < 0) {
+        std::cerr << "Unable to store " << iso_path << " as Form 2: " << iso_error_to_msg(ret) << std::endl;
+        return false;
+    }
+
+    IsoDir *parent = iso_node_get_parent(node);
+    std::string name = iso_node_get_name(node);
+    mode_t permissions = iso_node_get_permissions(node);
+    uid_t uid = iso_node_get_uid(node);
+    gid_t gid = iso_node_get_gid(node);
+    time_t atime = iso_node_get_atime(node);
+    time_t mtime = iso_node_get_mtime(node);
+    time_t ctime = iso_node_get_ctime(node);
+
+    iso_node_remove(node);
+
+    IsoFile *replacement = NULL;
+    ret = iso_image_add_new_file(iso, parent, name.c_str(), placeholder, &replacement);
+    if(ret < 0) {
+        iso_stream_unref(placeholder);
+        std::cerr << "Unable to store " << iso_path << " as Form 2: " << iso_error_to_msg(ret) << std::endl;
+        return false;
+    }
+
+    node = (IsoNode*) replacement;
+    iso_node_set_permissions(node, permissions);
+    iso_node_set_uid(node, uid);
+    iso_node_set_gid(node, gid);
+    iso_node_set_atime(node, atime);
+    iso_node_set_mtime(node, mtime);
+    iso_node_set_ctime(node, ctime);
+
+    if(verbosity() > 2) {
+        std::cout << std::dec << "Storing " << iso_path << " as Form 2 (" << xa_files.file(index).sectors.size() << " sectors)" << std::endl;
+    }
+
+    return true;
+}
+
+static bool apply_form2_rules(IsoImage *iso, XaFiles &xa_files) {
+    std::vector<std::pair<IsoNode*, std::string>> found;
+    find_form2_nodes(iso_image_get_root(iso), {}, found);
+
+    for(auto &[node, path] : found) {
+        if(!store_as_form2(iso, node, path, xa_files)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Builds the stream file an interleave description asks for, creating any
+ * directories on the way to it */
+static bool add_interleaved_file(IsoImage *iso, const std::string &description, XaFiles &xa_files) {
+    XaFile file;
+    if(!parse_interleave_file(description, file)) {
+        return false;
+    }
+
+    std::filesystem::path iso_path(file.iso_path);
+    IsoDir *parent = iso_image_get_root(iso);
+    for(const auto &part : iso_path.parent_path().relative_path()) {
+        IsoNode *node = NULL;
+        if(iso_dir_get_node(parent, part.string().c_str(), &node) == 1) {
+            if(iso_node_get_type(node) != LIBISO_DIR) {
+                std::cerr << "Unable to add " << file.iso_path << ", " << part.string() << " isn't a directory" << std::endl;
+                return false;
+            }
+            parent = (IsoDir*) node;
+        } else {
+            IsoDir *dir = NULL;
+            int ret = iso_image_add_new_dir(iso, parent, part.string().c_str(), &dir);
+            if(ret < 0) {
+                std::cerr << "Unable to add " << file.iso_path << ": " << iso_error_to_msg(ret) << std::endl;
+                return false;
+            }
+            parent = dir;
+        }
+    }
+
+    std::string name = iso_path.filename().string();
+    std::size_t index = xa_files.add_interleaved_file(std::move(file));
+
+    IsoStream *placeholder = NULL;
+    IsoFile *added = NULL;
+    int ret = xa_files.new_placeholder(index, &placeholder);
+    if(ret >= 0) {
+        ret = iso_image_add_new_file(iso, parent, name.c_str(), placeholder, &added);
+        if(ret < 0) {
+            iso_stream_unref(placeholder);
+        }
+    }
+
+    if(ret < 0) {
+        std::cerr << "Unable to add " << xa_files.file(index).iso_path << ": " << iso_error_to_msg(ret) << std::endl;
+        return false;
+    }
+
+    if(verbosity() > 2) {
+        const XaFile &added_file = xa_files.file(index);
+        std::cout << std::dec << "Interleaved " << added_file.streams.size() << " streams into " << added_file.iso_path
+                  << " (" << added_file.sectors.size() << " sectors)" << std::endl;
+    }
+
+    return true;
+}
+
+/* Adds a file or directory from the local filesystem to the ISO tree. Nothing
+ * is copied, libisofs reads the data from its original location when the image
+ * is written. Directories which already exist in the tree are merged, but a
+ * file can't replace an existing node. */
+static bool add_path_to_iso(IsoImage* iso, IsoDir* parent, const std::filesystem::path& path, const std::string& name) {
+    IsoNode* node = NULL;
+
+    if(iso_dir_get_node(parent, name.c_str(), &node) == 1) {
+        if(iso_node_get_type(node) != LIBISO_DIR || !std::filesystem::is_directory(path)) {
+            std::cerr << "Unable to add " << path << ", " << name << " already exists" << std::endl;
+            return false;
+        }
+    } else {
+        /* libisofs only resolves absolute paths */
+        auto source = std::filesystem::absolute(path);
+        int ret = iso_tree_add_new_node(iso, parent, name.c_str(), PATH_TO_CSTR(source), &node);
+        if(ret < 0) {
+            std::cerr << "Unable to add " << path << ": " << iso_error_to_msg(ret) << std::endl;
+            return false;
+        }
+    }
+
+    if(iso_node_get_type(node) == LIBISO_DIR) {
+        for(const auto& entry : std::filesystem::directory_iterator(path)) {
+            if(!add_path_to_iso(iso, (IsoDir*) node, entry.path(), entry.path().filename().string())) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool add_input_files(IsoImage* iso, IsoDir* root) {
+    if(verbosity() > 1) {
+        std::cout << "Gathering files from specified directories" << std::endl;
+    }
+
+    if(OPTS.count("directory")) {
+        for(std::filesystem::path dir: OPTS["directory"]) {
+            if(!std::filesystem::exists(dir)) {
+                std::cerr << "No such directory: " << dir.string() << std::endl;
+                return false;
+            }
+
+            /* An empty stem (e.g. a trailing slash) merges the contents into the root */
+            std::string stem = dir.stem().string();
+            if(stem.empty()) {
+                for(const auto& entry : std::filesystem::directory_iterator(dir)) {
+                    if(!add_path_to_iso(iso, root, entry.path(), entry.path().filename().string())) {
+                        return false;
+                    }
+                }
+            } else if(!add_path_to_iso(iso, root, dir, stem)) {
+                return false;
+            }
+        }
+    }
+
+    if(OPTS.count("directory-contents")) {
+        for(std::filesystem::path dir: OPTS["directory-contents"]) {
+            if(!std::filesystem::exists(dir)) {
+                std::cerr << "No such directory: " << dir.string() << std::endl;
+                return false;
+            }
+
+            for(const auto& entry : std::filesystem::directory_iterator(dir)) {
+                if(entry.path().filename() != "1ST_READ.BIN") {
+                    if(verbosity() > 2) {
+                        std::cout << "Adding file: " << entry.path().filename() << std::endl;
+                    }
+
+                    if(!add_path_to_iso(iso, root, entry.path(), entry.path().filename().string())) {
+                        return false;
+                    }
+                } else {
+                    if(verbosity() > 2) {
+                        std::cout << "Skipping 1ST_READ.BIN as we are generating a new one" << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    if(OPTS.count("file")) {
+        for(std::filesystem::path file: OPTS["file"]) {
+            if(!std::filesystem::exists(file)) {
+                std::cerr << "No such file: " << file.string() << std::endl;
+                return false;
+            }
+
+            if(verbosity() > 2) {
+                std::cout << file << " -> /" << file.filename().string() << std::endl;
+            }
+
+            if(!add_path_to_iso(iso, root, file, file.filename().string())) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+struct DataTrackReader {
+    struct burn_source* source = nullptr;
+    std::ofstream* iso_dump = nullptr;
+    bool failed = false;
+
+    /* When the libisofs writer thread was started and seen to finish */
+    uint64_t writer_start = 0;
+    uint64_t writer_end = 0;
+};
+
+/* libisofs doesn't report on its writer thread, but the state of the ring
+ * buffer between it and us shows when it has finished */
+static void trace_iso_writer(DataTrackReader* reader) {
+    if(!trace_enabled() || reader->writer_end) {
+        return;
+    }
+
+    size_t capacity = 0, free_bytes = 0;
+    int status = iso_ring_buffer_get_status(reader->source, &capacity, &free_bytes);
+    trace_counter("iso_ring_buffer_used", capacity - free_bytes);
+
+    if(status != 1) {
+        reader->writer_end = trace_now();
+        trace_span("libisofs writer", "iso_writer", reader->writer_start, reader->writer_end);
+    }
+}
+
+/* Forwards stages and counters from the disc image library */
+static void trace_disc_image(void* user_data, cd_trace_event_t event, const char* name, uint64_t value) {
+    (void) user_data;
+
+    switch(event) {
+    case CD_TRACE_BEGIN:
+        trace_begin(name);
+    break;
+    case CD_TRACE_END:
+        trace_end(name);
+    break;
+    case CD_TRACE_COUNTER:
+        trace_counter(name, value);
+    break;
+    }
+}
+
+struct ProgressDisplay {
+    DataTrackReader* reader = nullptr;
+    std::chrono::steady_clock::time_point last_update;
+    cd_progress_t last_progress = {};
+};
+
+/* Live status line while the image is written. How full the libisofs ring
+ * buffer is shows which side is holding things up: it runs empty when
+ * libisofs can't keep up, and stays full when encoding or output is slow. */
+static void show_progress(void* user_data, const cd_progress_t* progress) {
+    auto display = (ProgressDisplay*) user_data;
+    display->last_progress = *progress;
+
+    auto now = std::chrono::steady_clock::now();
+    bool finished = progress->sectors_written >= progress->total_sectors;
+    if(!finished && now - display->last_update < std::chrono::milliseconds(250)) {
+        return;
+    }
+    display->last_update = now;
+
+    size_t capacity = 0, free_bytes = 0;
+    iso_ring_buffer_get_status(display->reader->source, &capacity, &free_bytes);
+    int buffer_fill = (capacity) ? int(100 * (capacity - free_bytes) / capacity) : 0;
+
+    int percent = (progress->total_sectors) ? int(100 * progress->sectors_written / progress->total_sectors) : 100;
+    const char* kind = (progress->track_mode == TRACK_MODE_CDDA) ? "audio" : "data";
+    double rate = (finished) ? progress->mb_per_second : progress->current_mb_per_second;
+
+    /* Formatted on its own stream, so std::cout's formatting neither
+     * affects the line nor is changed by it */
+    std::ostringstream line;
+    line << "\rWriting track " << progress->track << "/" << progress->track_count << " (" << kind << "): "
+         << std::setw(3) << percent << "%  "
+         << progress->sectors_written << "/" << progress->total_sectors << " sectors  "
+         << std::fixed << std::setprecision(1) << rate << " MB/s  "
+         << "ISO buffer " << std::setw(3) << buffer_fill << "%   ";
+    std::cout << line.str() << std::flush;
+}
+
+/* Number of files in the ISO tree, for the trace */
+static std::size_t iso_tree_file_count(IsoDir* dir) {
+    std::size_t count = 0;
+
+    IsoNode* node;
+    IsoDirIter* iter;
+
+    if(iso_dir_get_children(dir, &iter) < 0) {
+        return 0;
+    }
+
+    while(iso_dir_iter_next(iter, &node) == 1) {
+        if(iso_node_get_type(node) == LIBISO_DIR) {
+            count += iso_tree_file_count((IsoDir*) node);
+        } else {
+            ++count;
+        }
+    }
+
+    iso_dir_iter_free(iter);
+    return count;
+}
+
+/* Pulls the next part of the ISO from libisofs as the data track is written.
+ * The disc image library only ever asks for what is left of the track, so
+ * the final read ends exactly on the end of the image. */
+static int read_data_track(void* user_data, uint8_t* buffer, size_t len) {
+    auto reader = (DataTrackReader*) user_data;
+
+    int read = reader->source->read_xt(reader->source, buffer, len);
+    if(read < 0) {
+        reader->failed = true;
+        return read;
+    }
+
+    if(read > 0 && reader->iso_dump) {
+        reader->iso_dump->write((char*) buffer, read);
+    }
+
+    trace_iso_writer(reader);
+    return read;
+}
+
+bool build_cdi(const std::vector<char>& boot_bin) {
+    TraceScope trace("build_cdi");
     std::string output_cdi = OPTS["output"][0];
 
     IPBin ip_bin;
@@ -839,24 +1244,36 @@ bool build_cdi(const std::filesystem::path& input_dir) {
         }
     }
     if (!use_custom_ipbin){
-        generate_ip_bin(input_dir, input_dir / "1ST_READ.BIN", &ip_bin);
+        TraceScope trace_ip_bin("generate_ip_bin");
+        generate_ip_bin(boot_bin, &ip_bin);
     }
 
     /* Generate CDI image */
     cd_image_t* img = cd_new_image();
     cd_image_set_volume_name(img, PATH_TO_CSTR(std::filesystem::path(output_cdi).filename().stem()));
 
+    if(trace_enabled()) {
+        cd_image_set_trace_hook(img, trace_disc_image, NULL);
+    }
+
+    MemoryPlan memory_plan = plan_memory();
+    cd_image_set_batch_sectors(img, memory_plan.batch_sectors);
+    cd_image_set_threads(img, jobs());
+    cd_image_set_direct_io(img, OPTS.count("direct-io") > 0);
+
     /* Add the first session, this is where CDDA tracks go */
+    memory_stage_begin("load_cdda");
     cd_session_t* session0 = cd_new_session(img);
+    OpenFds cdda_fds;
 
     if(OPTS.count("cdda")) {
         size_t track_idx = 0;
+        std::size_t cdda_in_memory = 0;
         for(auto& filename: OPTS["cdda"]) {
             ++track_idx;
-            auto data_maybe = wav_to_cdda(filename);
-            if(data_maybe) {
-                auto data = data_maybe.value();
-
+            TraceScope trace_cdda("load_cdda");
+            auto wav = find_wav_data(filename, verbosity() > 2);
+            if(wav) {
                 size_t const audio_sector_size = 2352;
                 size_t const audio_bytes_per_second = 176400;
                 size_t const minimum_track_sectors = 300;
@@ -864,15 +1281,30 @@ bool build_cdi(const std::filesystem::path& input_dir) {
                 size_t const minimum_track_duration = minimum_track_size / audio_bytes_per_second;
 
                 /* Enforce audio track size */
-                if (data.size() < minimum_track_size) {
+                if (wav->length < minimum_track_size) {
                     std::cerr << "Audio file " << filename << " is too short - it must be at least " << minimum_track_size << " bytes (" << minimum_track_duration << " seconds)" << std::endl;
                     return false;
                 }
 
-                cd_new_track(session0, TRACK_TYPE_AUDIO, &data[0], data.size());
+                /* Tracks are loaded into memory while they fit, after that
+                 * they are read from the file as they are written */
+                cd_track_source_t* source = NULL;
+                if(cdda_in_memory + wav->length <= memory_plan.cdda_memory_limit) {
+                    source = load_wav_data(filename, *wav);
+                    cdda_in_memory += wav->length;
+                } else {
+                    int fd = -1;
+                    source = stream_wav_data(filename, *wav, &fd);
+                    if(!source) {
+                        return false;
+                    }
+                    cdda_fds.add(fd);
+                }
+
+                cd_new_track_from_source(session0, TRACK_TYPE_AUDIO, source);
 
                 if (verbosity() > 0) {
-                    std::cout << std::dec << "Added track " << track_idx << " (" << data.size() << " bytes) from " << filename << std::endl;
+                    std::cout << std::dec << "Added track " << track_idx << " (" << wav->length << " bytes) from " << filename << std::endl;
                 }
             } else {
                 return false;
@@ -884,16 +1316,9 @@ bool build_cdi(const std::filesystem::path& input_dir) {
 
     size_t start_lba = cd_session_length_in_sectors(session0);
 
-    std::size_t padding_file_size = estimate_padding_sectors(img, input_dir) * 2048;
-
-    if(!OPTS.count("no-padding") && padding_file_size > 0) {
-        std::ofstream null_file(std::filesystem::path(input_dir) / "0.0");
-        std::vector<uint8_t> null_data(padding_file_size, 0);
-        null_file.write((char*) &null_data[0], null_data.size());
-        null_file.close();
-    }
-
     /* Build ISO */
+    memory_stage_begin("build_iso_tree");
+    TraceScope trace_iso_tree("build_iso_tree");
     iso_init();
 
     IsoImage* iso = NULL;
@@ -907,13 +1332,77 @@ bool build_cdi(const std::filesystem::path& input_dir) {
     name = name.substr(0, 15);
     iso_image_new(name.c_str(), &iso);
 
-    iso_tree_set_follow_symlinks(iso, 0);
+    /* Symlinks in the inputs are stored as the files they point to */
+    iso_tree_set_follow_symlinks(iso, 1);
     iso_tree_set_ignore_hidden(iso, 0);
     iso_tree_set_ignore_special(iso, 0);
 
     root = iso_image_get_root(iso);
 
-    iso_tree_add_dir_rec(iso, root, PATH_TO_CSTR(input_dir));
+    /* libisofs takes ownership of the buffer and free()s it */
+    unsigned char* boot_data = (unsigned char*) malloc(boot_bin.size());
+    std::copy(boot_bin.begin(), boot_bin.end(), boot_data);
+
+    IsoStream* boot_stream = NULL;
+    int ret = iso_memory_stream_new(boot_data, boot_bin.size(), &boot_stream);
+    if(ret >= 0) {
+        ret = iso_image_add_new_file(iso, root, "1ST_READ.BIN", boot_stream, NULL);
+        if(ret < 0) {
+            iso_stream_unref(boot_stream);
+        }
+    } else {
+        free(boot_data);
+    }
+
+    if(ret < 0) {
+        std::cerr << "Unable to add 1ST_READ.BIN: " << iso_error_to_msg(ret) << std::endl;
+        return false;
+    }
+
+    if(!add_input_files(iso, root)) {
+        return false;
+    }
+
+    XaFiles xa_files;
+    if(OPTS.count("form2-file")) {
+        if(!parse_form2_file(OPTS["form2-file"][0]) || !apply_form2_rules(iso, xa_files)) {
+            return false;
+        }
+    }
+
+    if(OPTS.count("xa-interleave")) {
+        for(auto& description: OPTS["xa-interleave"]) {
+            if(!add_interleaved_file(iso, description, xa_files)) {
+                return false;
+            }
+        }
+    }
+
+    /* The padding starts out empty, it's resized once the layout of the
+     * rest of the image is known */
+    IsoStream* null_stream = NULL;
+    IsoFile* null_file = NULL;
+
+    if(!OPTS.count("no-padding")) {
+        /* The padding is never stored anywhere, libisofs reads it from a
+         * stream of zeros when the image is written */
+        ret = iso_zero_stream_new(0, &null_stream);
+        if(ret >= 0) {
+            /* The file takes over our reference to the stream */
+            ret = iso_image_add_new_file(iso, root, "0.0", null_stream, &null_file);
+            if(ret < 0) {
+                iso_stream_unref(null_stream);
+            }
+        }
+
+        if(ret < 0) {
+            std::cerr << "Unable to add padding file: " << iso_error_to_msg(ret) << std::endl;
+            return false;
+        }
+
+        /* Make sure we give the special 0.0 file the most weight */
+        iso_node_set_sort_weight((IsoNode*) null_file, INT_MAX);
+    }
 
     if(OPTS.count("sort-file") && parse_sort_file(OPTS["sort-file"][0])) {
         if(verbosity() > 2) {
@@ -933,36 +1422,57 @@ bool build_cdi(const std::filesystem::path& input_dir) {
         }
     }
 
+    if(trace_enabled()) {
+        trace_counter("iso_files", iso_tree_file_count(root));
+    }
+    trace_iso_tree.end();
+
     iso_write_opts_new(&opts, 0);
     iso_write_opts_set_joliet(opts, 1);
     iso_write_opts_set_rockridge(opts, 1);
     iso_write_opts_set_system_area(opts, (char*) &ip_bin, 0, 0);
     iso_write_opts_set_ms_block(opts, start_lba);
+    iso_write_opts_set_fifo_size(opts, memory_plan.fifo_blocks);
 
-    struct burn_source* burn_src;
-    iso_image_create_burn_source(iso, opts, &burn_src);
+    if(null_file) {
+        const int32_t padded_disc_sectors = 333000;
 
-    if(verbosity() > 0) {
-        std::cout << "Generating data track...    " << std::flush;
-    }
+        /* An empty file takes no blocks, so every block given to the padding
+         * moves the end of the image by exactly one sector */
+        off_t unpadded_size = compute_iso_size(iso, opts);
+        if(unpadded_size < 0) {
+            return false;
+        }
 
-    std::vector<uint8_t> iso_data;
-    unsigned char buf[2048];
-    while (int read = burn_src->read_xt(burn_src, buf, 2048)) {
-        iso_data.insert(iso_data.end(), buf, buf + read);
-    }
+        int32_t used = int32_t(start_lba + unpadded_size / 2048);
+        int32_t padding_sectors = std::max(padded_disc_sectors - used, 0);
 
-    free(burn_src);
-    iso_write_opts_free(opts);
+        if(verbosity() > 2) {
+            std::cout << std::dec << "Padding data track with " << padding_sectors << " sectors" << std::endl;
+        }
 
-    if(verbosity() > 0) {
-        std::cout << "Done." << std::endl;
+        if(padding_sectors > 0) {
+            iso_zero_stream_set_size(null_stream, off_t(padding_sectors) * 2048);
+        } else {
+            iso_node_remove((IsoNode*) null_file);
+        }
     }
 
+    memory_stage_begin("write_image");
+
+    DataTrackReader reader;
+    reader.writer_start = trace_now();
+
+    struct burn_source* burn_src;
+    iso_image_create_burn_source(iso, opts, &burn_src);
+    reader.source = burn_src;
+
+    std::size_t iso_size = burn_src->get_size(burn_src);
     if(verbosity() > 2) {
-        std::cout << "Data track size: " << iso_data.size() << " bytes" << std::endl;
+        std::cout << "Data track size: " << iso_size << " bytes" << std::endl;
     }
 
+    std::ofstream iso_out;
     if(OPTS.count("dump-iso")) {
         std::string iso_path = PATH_TO_CSTR(std::filesystem::path(output_cdi).replace_extension("iso"));
 
@@ -970,20 +1480,67 @@ bool build_cdi(const std::filesystem::path& input_dir) {
             std::cout << "Dumping .iso to: " << iso_path << std::endl;
         }
 
-        std::ofstream iso_out(iso_path, std::ios::binary);
-        iso_out.write((char*) &iso_data[0], iso_data.size());
+        iso_out.open(iso_path, std::ios::binary);
+        reader.iso_dump = &iso_out;
     }
 
+    /* The data track is encoded as libisofs generates it, so the image is
+     * never held in memory */
     cd_session_t* session1 = cd_new_session(img);
-    cd_track_t* data = cd_new_track(session1, TRACK_TYPE_DATA, &iso_data[0], iso_data.size());
+    cd_track_t* data = cd_new_track_streamed(session1, TRACK_TYPE_DATA, read_data_track, &reader, iso_size);
     cd_track_set_mode(data, TRACK_MODE_XA_MODE2_FORM1);
     cd_track_set_postgap_sectors(data, 2); /* Add 2 sectors of postgap to the data track */
 
+    if(!xa_files.empty()) {
+        cd_track_set_sector_hook(data, XaFiles::sector_hook, &xa_files);
+    }
+
+    ProgressDisplay display;
+    display.reader = &reader;
+
+    if(verbosity() > 0) {
+        std::cout << "Writing " << output_cdi << std::endl;
+        cd_image_set_progress_callback(img, show_progress, &display);
+    }
+
     const char* fname = output_cdi.c_str();
     FILE* output = fopen(fname, "wb");
-    cd_write_to_cdi(img, output, fname);
+    bool written = output && cd_write_to_cdi(img, output, fname);
     cd_free_image(&img);
-    fclose(output);
+    if(output && fclose(output) != 0) {
+        written = false;
+    }
+
+    cdda_fds.close_all();
+
+    if(trace_enabled() && !reader.writer_end) {
+        trace_span("libisofs writer", "iso_writer", reader.writer_start, trace_now());
+    }
+
+    burn_src->free_data(burn_src);
+    free(burn_src);
+    iso_write_opts_free(opts);
+
+    if(reader.failed) {
+        std::cerr << "Failed to read the data track from libisofs" << std::endl;
+        return false;
+    }
+
+    if(xa_files.failed()) {
+        return false;
+    }
+
+    if(!written) {
+        std::cerr << "Failed to write " << output_cdi << std::endl;
+        return false;
+    }
+
+    if(verbosity() > 0) {
+        auto& progress = display.last_progress;
+        std::cout << std::endl << "Done. " << std::fixed << std::setprecision(1)
+                  << progress.bytes_written / 1e6 << " MB in " << progress.elapsed_seconds << "s ("
+                  << progress.mb_per_second << " MB/s)" << std::endl;
+    }
 
     return true;
 }
@@ -1011,24 +1568,53 @@ int main(int argc, char* argv[]) {
         std::cout << "Pre-run checks finished. Beginning generation!" << std::endl;
     }
 
-    auto temp_dir_maybe = generate_temporary_directory();
-    if(!temp_dir_maybe) {
-        return 4;
+    if(OPTS.count("max-memory")) {
+        /* Up to 19 digits always fits in an unsigned long long, the range
+         * check then keeps the budget in bytes inside a size_t */
+        const std::string& value = OPTS["max-memory"][0];
+        const unsigned long long max_mb = SIZE_MAX / (1024 * 1024);
+        if(value.empty() || value.size() > 19 || !std::all_of(value.begin(), value.end(), ::isdigit) ||
+           std::stoull(value) < 1 || std::stoull(value) > max_mb) {
+            std::cerr << "--max-memory must be a number of MB between 1 and " << max_mb << std::endl;
+            return 2;
+        }
+        MEMORY_BUDGET = std::stoull(value) * 1024 * 1024;
     }
 
-    auto temp_dir = temp_dir_maybe.value();
+    if(OPTS.count("jobs")) {
+        const std::string& value = OPTS["jobs"][0];
+        if(value.empty() || value.size() > 2 || !std::all_of(value.begin(), value.end(), ::isdigit) ||
+           std::stoul(value) < 1 || std::stoul(value) > CD_IMAGE_MAX_THREADS) {
+            std::cerr << "--jobs must be a number between 1 and " << CD_IMAGE_MAX_THREADS << std::endl;
+            return 2;
+        }
+    }
 
-    if(!gather_files(temp_dir)) {
-        destroy_temp_directory(temp_dir);
-        return 4;
+    if(OPTS.count("trace")) {
+        trace_enable();
     }
 
-    if(!build_cdi(temp_dir)) {
+    int ret = 0;
+    std::vector<char> boot_bin;
+    memory_stage_begin("gather_files");
+    if(!gather_files(boot_bin)) {
+        ret = 4;
+    } else if(!build_cdi(boot_bin)) {
         std::cout << "Error building CDI" << std::endl;
-        destroy_temp_directory(temp_dir);
-        return 5;
+        ret = 5;
+    }
+
+    if((OPTS.count("max-memory") && verbosity() > 0) || verbosity() > 1) {
+        memory_print_report(std::cout, MEMORY_BUDGET);
+    }
+
+    if(OPTS.count("trace")) {
+        if(verbosity() > 1) {
+            std::cout << "Writing trace to " << OPTS["trace"][0] << std::endl;
+        }
+
+        trace_write(OPTS["trace"][0]);
     }
 
-    destroy_temp_directory(temp_dir);
-    return 0;
+    return ret;
 }
@@ -0,0 +1,135 @@
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+struct MemoryStage {
+    std::string name;
+    std::size_t peak;
+};
+
+std::vector<MemoryStage> stages;
+bool in_stage = false;
+
+/* Peaks can only be measured per stage if the high water mark can be reset,
+ * otherwise each stage reports the peak of the run so far */
+bool peak_is_per_stage = true;
+
+#ifdef __linux__
+std::size_t read_proc_status(const char* field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    std::size_t len = std::char_traits<char>::length(field);
+
+    while(std::getline(status, line)) {
+        if(line.compare(0, len, field) == 0) {
+            return std::stoull(line.substr(len + 1)) * 1024; /* Reported in kB */
+        }
+    }
+
+    return 0;
+}
+#endif
+
+bool reset_peak_rss() {
+#ifdef __linux__
+    /* Writing 5 to clear_refs resets VmHWM to the current RSS */
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.close();
+    return bool(clear_refs);
+#else
+    return false;
+#endif
+}
+
+}
+
+std::size_t memory_current_rss() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#elif defined(__linux__)
+    return read_proc_status("VmRSS:");
+#else
+    return 0;
+#endif
+}
+
+std::size_t memory_peak_rss() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#elif defined(__linux__)
+    return read_proc_status("VmHWM:");
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss; /* Bytes on macOS, kB everywhere else */
+#else
+    return usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+void memory_stage_begin(const char* name) {
+    memory_stage_end();
+
+    if(!reset_peak_rss()) {
+        peak_is_per_stage = false;
+    }
+
+    stages.push_back({name, 0});
+    in_stage = true;
+}
+
+void memory_stage_end() {
+    if(in_stage) {
+        stages.back().peak = memory_peak_rss();
+        in_stage = false;
+    }
+}
+
+void memory_print_report(std::ostream& out, std::size_t budget) {
+    memory_stage_end();
+
+    const double MB = 1024.0 * 1024.0;
+
+    std::size_t overall = 0;
+    for(auto& stage: stages) {
+        overall = std::max(overall, stage.peak);
+    }
+
+    out << "Peak memory use" << ((peak_is_per_stage) ? "" : " (so far, by end of stage)") << ":" << std::endl;
+    out << std::fixed << std::setprecision(1);
+    for(auto& stage: stages) {
+        out << "  " << std::left << std::setw(16) << stage.name << std::right
+            << std::setw(8) << stage.peak / MB << " MB" << std::endl;
+    }
+
+    if(budget) {
+        out << "  " << std::left << std::setw(16) << "budget" << std::right
+            << std::setw(8) << budget / MB << " MB" << ((overall > budget) ? " (exceeded)" : "") << std::endl;
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+/* Process memory use, as resident set size in bytes. Returns 0 where the
+ * platform can't tell us. */
+std::size_t memory_current_rss();
+std::size_t memory_peak_rss();
+
+/* Tracks the peak memory use of each stage of the run. Stages don't nest,
+ * beginning a stage ends the previous one. */
+void memory_stage_begin(const char* name);
+void memory_stage_end();
+
+void memory_print_report(std::ostream& out, std::size_t budget);
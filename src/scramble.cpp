@@ -5,62 +5,229 @@
 
 #include "scramble.h"
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
-#include <vector>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <string.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCRAMBLE_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
 // 2MB Max Chunk
 const int MAX_CHUNK = (2 * 1024 * 1024);
 const int SLICE_SIZE = 32;
 
+// The generator is seed = (seed * 2109 + 9273) mod 2^15, which goes
+// through all 2^15 values before repeating
+const uint32_t LCG_MULTIPLIER = 2109;
+const uint32_t LCG_INCREMENT = 9273;
+const uint32_t LCG_MASK = 0x7fff;
 
+// Slice indexes inside a chunk. A chunk has at most 65536 slices, so they
+// fit in 16 bits
+typedef std::vector<uint16_t> Permutation;
 
-std::vector<char> scramble(std::vector<char>& unscrambled_bin)
-{
-    // seed value is initialized with chunk size
-    unsigned int seed = unscrambled_bin.size() & 0xffff;
+namespace {
+
+struct Chunk {
+    int pos;
+    int size;
+    uint32_t seed;
+};
 
-    // Returns next rand value used for scramble algo
-    auto rand = [&seed]() -> unsigned int
+// The seed after `steps` more draws. Applying the generator twice is
+// another LCG, (a * a, (a + 1) * c), so this squares its way up through the
+// bits of steps rather than drawing them all
+uint32_t lcg_jump(uint32_t seed, uint64_t steps) {
+    uint32_t mul = LCG_MULTIPLIER, add = LCG_INCREMENT;
+    uint32_t total_mul = 1, total_add = 0;
+
+    while (steps)
     {
-        seed = (seed * 2109 + 9273) & 0x7fff;
-        return (seed + 0xc000) & 0xffff;
-    };
+        if (steps & 1)
+        {
+            total_mul = (total_mul * mul) & LCG_MASK;
+            total_add = (total_add * mul + add) & LCG_MASK;
+        }
+
+        add = ((mul + 1) * add) & LCG_MASK;
+        mul = (mul * mul) & LCG_MASK;
+        steps >>= 1;
+    }
+
+    return (seed * total_mul + total_add) & LCG_MASK;
+}
+
+// Everything needed to move a chunk's slices around in place, either way
+struct ChunkOrder {
+    // Where each output slice of the scrambled chunk comes from, and the
+    // other way round
+    Permutation forward;
+    Permutation inverse;
+
+    // A slice from each cycle of the permutation, leaving out slices which
+    // stay where they are. Each cycle is followed from there, so only one
+    // slice is ever held aside
+    Permutation cycles;
+};
+
+// The slice order for a chunk of chunk_size bytes, starting from seed
+void build_order(ChunkOrder& order, int chunk_size, uint32_t seed) {
+    // Number of 32byte slices in chunk
+    int num_slices = chunk_size / SLICE_SIZE;
+
+    // Initialize Array with Indexs
+    Permutation idx(num_slices);
+    for (int i = 0; i < num_slices; i++)
+        idx[i] = uint16_t(i);
+
+    order.forward.resize(num_slices);
+    order.inverse.resize(num_slices);
+
+    int slice_index = 0;
+    // Start at last slice of chunk
+    for (int i = num_slices - 1; i >= 0; --i)
+    {
+        // Get new index using rand algo
+        seed = (seed * LCG_MULTIPLIER + LCG_INCREMENT) & LCG_MASK;
+        unsigned int rand = (seed + 0xc000) & 0xffff;
+        int x = (rand * i) >> 16;
+
+        // Swap new and old indexs
+        std::swap(idx[i], idx[x]);
 
-    // Lambda to do slicing and restitching of chunks
-    auto reorder_slices = [rand](char * dest, const char* src, int chunk_size)
+        // The slice inside the chunk that goes next
+        order.forward[slice_index] = idx[i];
+        order.inverse[idx[i]] = uint16_t(slice_index);
+        slice_index++;
+    }
+
+    std::vector<bool> seen(num_slices);
+    for (int i = 0; i < num_slices; i++)
     {
-        // Number of 32byte slices in chunk
-        int num_slices = chunk_size / SLICE_SIZE;
-
-        // Array to hold slice index mapping
-        int idx[MAX_CHUNK / SLICE_SIZE];
-        // Initialize Array with Indexs
-        for (int i = 0; i < num_slices; i++)
-            idx[i] = i;
-
-        int slice_index = 0;
-        // Start at last slice of chunk
-        for (int i = num_slices - 1; i >= 0; --i)
-        {   
-            // Get new index using rand algo
-            int x = (rand() * i) >> 16;
-
-            // Swap new and old indexs
-            std::swap(idx[i], idx[x]);
-
-            // Find the location of the slice inside the chunk
-            // that we want to copy
-            const char * start = &src[SLICE_SIZE * idx[i]];
-            
-            // Write slice to output buffer
-            memcpy(&dest[slice_index * SLICE_SIZE], start, SLICE_SIZE);
-            slice_index++;
+        if (seen[i] || order.forward[i] == i)
+            continue;
+
+        order.cycles.push_back(uint16_t(i));
+        for (int j = i; !seen[j]; j = order.forward[j])
+            seen[j] = true;
+    }
+}
+
+// Orders by chunk size and seed. Chunks of 1MB and up use the whole period
+// of the generator, so every one of them in a binary starts from the same
+// seed and shares an order
+class OrderCache {
+public:
+    std::shared_ptr<const ChunkOrder> get(int chunk_size, uint32_t seed) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            auto& slot = m_Entries[std::make_pair(chunk_size, seed)];
+            if (!slot)
+                slot = std::make_shared<Entry>();
+            entry = slot;
         }
+
+        // Built outside the lock, so threads only wait for one they need
+        std::call_once(entry->built, [&]() {
+            build_order(entry->order, chunk_size, seed);
+        });
+
+        return std::shared_ptr<const ChunkOrder>(entry, &entry->order);
+    }
+
+    // Only the large orders are worth keeping between binaries
+    void trim() {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (auto it = m_Entries.begin(); it != m_Entries.end();)
+        {
+            if (it->first.first < MIN_KEPT_CHUNK)
+                it = m_Entries.erase(it);
+            else
+                ++it;
+        }
+    }
+
+private:
+    static const int MIN_KEPT_CHUNK = 64 * 1024;
+
+    struct Entry {
+        std::once_flag built;
+        ChunkOrder order;
     };
 
+    std::mutex m_Lock;
+    std::map<std::pair<int, uint32_t>, std::shared_ptr<Entry>> m_Entries;
+};
+
+OrderCache order_cache;
+
+// Puts slice i of the chunk where slice from[i] was. Each cycle starts by
+// holding its first slice aside, then pulls each slice into the gap the
+// last one left, until the held slice fills the final gap
+void permute_slices_generic(char* chunk, const Permutation& from, const Permutation& cycles) {
+    char held[SLICE_SIZE];
+
+    for (uint16_t start : cycles)
+    {
+        // Fixed size copies, which compilers turn into vector moves
+        memcpy(held, &chunk[start * SLICE_SIZE], SLICE_SIZE);
+
+        size_t i = start;
+        for (size_t next = from[i]; next != start; i = next, next = from[i])
+            memcpy(&chunk[i * SLICE_SIZE], &chunk[next * SLICE_SIZE], SLICE_SIZE);
+
+        memcpy(&chunk[i * SLICE_SIZE], held, SLICE_SIZE);
+    }
+}
+
+#ifdef SCRAMBLE_HAVE_X86
+// Each slice is exactly one 256 bit register, so the held slice never
+// leaves one
+__attribute__((target("avx")))
+void permute_slices_avx(char* chunk, const Permutation& from, const Permutation& cycles) {
+    for (uint16_t start : cycles)
+    {
+        __m256i held = _mm256_loadu_si256((const __m256i*) &chunk[start * SLICE_SIZE]);
+
+        size_t i = start;
+        for (size_t next = from[i]; next != start; i = next, next = from[i])
+        {
+            __m256i slice = _mm256_loadu_si256((const __m256i*) &chunk[next * SLICE_SIZE]);
+            _mm256_storeu_si256((__m256i*) &chunk[i * SLICE_SIZE], slice);
+        }
+
+        _mm256_storeu_si256((__m256i*) &chunk[i * SLICE_SIZE], held);
+    }
+}
+#endif
+
+void permute_slices(char* chunk, const Permutation& from, const Permutation& cycles) {
+#ifdef SCRAMBLE_HAVE_X86
+    static const bool have_avx = __builtin_cpu_supports("avx");
+    if (have_avx)
+    {
+        permute_slices_avx(chunk, from, cycles);
+        return;
+    }
+#endif
+    permute_slices_generic(chunk, from, cycles);
+}
+
+// Scrambles or descrambles each chunk of the binary in place
+void reorder(std::vector<char>& bin, unsigned int threads, bool inverse)
+{
     // Start attempting to read max chunk of 2MB and reorder slices in chunk
     // When remaining data is <2MB then shrink the chunk size down a power of 2
     // Example: My binary for 2ndmix is 660816 bytes
@@ -81,12 +248,15 @@ std::vector<char> scramble(std::vector<char>& unscrambled_bin)
     //      chunk_size = 128B   None                80B     Remaining
     //      chunk_size = 64B    1 Chunk Sliced      16B     Remaining
     //      chunk_size = 32B    None                16B     Remaining
-    //      Write Remaining 16B without slicing since <32B slice size
+    //      Final 16B stay where they are since <32B slice size
+
+    int size = bin.size();
 
-    
-    int size = unscrambled_bin.size();
-    std::vector<char> scrambled_bin(size);
-    
+    // seed value is initialized with chunk size. Each chunk draws once per
+    // slice, so the seed it starts with can be jumped to directly
+    uint32_t seed = bin.size() & 0xffff;
+
+    std::vector<Chunk> chunks;
     int pos = 0;
     // Loop though each valid chunk size starting at 2MB and
     // decreasing by powers of 2 down to the slice min (32B)
@@ -94,17 +264,50 @@ std::vector<char> scramble(std::vector<char>& unscrambled_bin)
     {
         while (size >= chunk_size)
         {
-            reorder_slices(&scrambled_bin[pos], &unscrambled_bin[pos], chunk_size);
+            chunks.push_back({pos, chunk_size, seed & LCG_MASK});
+            seed = lcg_jump(seed & LCG_MASK, chunk_size / SLICE_SIZE);
             pos += chunk_size;
             size -= chunk_size;
         }
     }
 
-    // Save final partial slice if any data is remaining
-    if (size)
+    // Chunks are independent now, so each thread takes the next one left
+    std::atomic<size_t> next_chunk(0);
+    auto worker = [&]() {
+        for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++)
+        {
+            const Chunk& chunk = chunks[i];
+            auto order = order_cache.get(chunk.size, chunk.seed);
+            permute_slices(&bin[chunk.pos], (inverse) ? order->inverse : order->forward, order->cycles);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    try
+    {
+        for (unsigned int i = 1; i < threads && i < chunks.size(); ++i)
+            workers.emplace_back(worker);
+    }
+    catch (const std::system_error&)
     {
-        memcpy(&scrambled_bin[pos], &unscrambled_bin[pos], size);
+        // Carry on with however many threads did start
     }
+    worker();
 
-    return scrambled_bin;
+    for (auto& thread : workers)
+        thread.join();
+
+    order_cache.trim();
+}
+
+}
+
+void scramble(std::vector<char>& bin, unsigned int threads)
+{
+    reorder(bin, threads, false);
+}
+
+void descramble(std::vector<char>& bin, unsigned int threads)
+{
+    reorder(bin, threads, true);
 }
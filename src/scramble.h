@@ -4,4 +4,11 @@
 #include <optional>
 #include <vector>
 
-std::vector<char> scramble(std::vector<char>& unscrambled_bin);
\ No newline at end of file
+/* Scrambles a binary in place, into the order the boot ROM loads
+ * 1ST_READ.BIN in. Nothing the size of the binary is allocated. Chunks are
+ * scrambled on up to `threads` threads, the result is the same for any
+ * number */
+void scramble(std::vector<char>& bin, unsigned int threads = 1);
+
+/* Undoes scramble(), in place */
+void descramble(std::vector<char>& bin, unsigned int threads = 1);
@@ -0,0 +1,176 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    std::string name;
+    char phase;      /* B, E, C or X */
+    uint64_t ts;
+    uint64_t dur;    /* X only */
+    uint64_t value;  /* C only */
+    int tid;
+};
+
+std::mutex trace_mutex;
+bool enabled = false;
+std::chrono::steady_clock::time_point start_time;
+std::vector<TraceEvent> events;
+
+/* Threads and lanes are both shown as threads, lanes are numbered after the
+ * real threads so the two never collide */
+std::map<std::thread::id, int> thread_ids;
+std::map<std::string, int> lane_ids;
+const int FIRST_LANE_ID = 1000;
+
+int current_thread_id() {
+    auto it = thread_ids.find(std::this_thread::get_id());
+    if(it != thread_ids.end()) {
+        return it->second;
+    }
+
+    int id = int(thread_ids.size()) + 1;
+    thread_ids[std::this_thread::get_id()] = id;
+    return id;
+}
+
+int lane_id(const std::string& lane) {
+    auto it = lane_ids.find(lane);
+    if(it != lane_ids.end()) {
+        return it->second;
+    }
+
+    int id = FIRST_LANE_ID + int(lane_ids.size());
+    lane_ids[lane] = id;
+    return id;
+}
+
+uint64_t elapsed_us() {
+    auto elapsed = std::chrono::steady_clock::now() - start_time;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+void record(const char* name, char phase, uint64_t value) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    if(!enabled) {
+        return;
+    }
+
+    events.push_back({name, phase, elapsed_us(), 0, value, current_thread_id()});
+}
+
+std::string escape_json(const std::string& str) {
+    std::string out;
+    for(char c: str) {
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if((unsigned char) c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+
+    return out;
+}
+
+}
+
+void trace_enable() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    if(!enabled) {
+        enabled = true;
+        start_time = std::chrono::steady_clock::now();
+    }
+}
+
+bool trace_enabled() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    return enabled;
+}
+
+void trace_begin(const char* name) {
+    record(name, 'B', 0);
+}
+
+void trace_end(const char* name) {
+    record(name, 'E', 0);
+}
+
+void trace_counter(const char* name, uint64_t value) {
+    record(name, 'C', value);
+}
+
+uint64_t trace_now() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    return (enabled) ? elapsed_us() : 0;
+}
+
+void trace_span(const char* lane, const char* name, uint64_t start, uint64_t end) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    if(!enabled) {
+        return;
+    }
+
+    uint64_t dur = (end > start) ? end - start : 0;
+    events.push_back({name, 'X', start, dur, 0, lane_id(lane)});
+}
+
+bool trace_write(const std::filesystem::path& path) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+
+    std::ofstream out(path, std::ios::binary);
+    if(!out) {
+        std::cerr << "Unable to open trace file: " << path << std::endl;
+        return false;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool first = true;
+    auto separator = [&first]() {
+        const char* sep = (first) ? "" : ",\n";
+        first = false;
+        return sep;
+    };
+
+    for(auto& thread: thread_ids) {
+        std::string name = (thread.second == 1) ? "main" : "thread " + std::to_string(thread.second);
+        out << separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.second
+            << ",\"args\":{\"name\":\"" << name << "\"}}";
+    }
+
+    for(auto& lane: lane_ids) {
+        out << separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << lane.second
+            << ",\"args\":{\"name\":\"" << escape_json(lane.first) << "\"}}";
+    }
+
+    for(auto& event: events) {
+        std::string name = escape_json(event.name);
+        out << separator() << "{\"name\":\"" << name << "\",\"ph\":\"" << event.phase
+            << "\",\"ts\":" << event.ts << ",\"pid\":1,\"tid\":" << event.tid;
+
+        if(event.phase == 'X') {
+            out << ",\"dur\":" << event.dur;
+        } else if(event.phase == 'C') {
+            out << ",\"args\":{\"" << name << "\":" << event.value << "}";
+        }
+
+        out << "}";
+    }
+
+    out << "\n]}\n";
+    return bool(out);
+}
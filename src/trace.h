@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+/* Records timing spans and counters, and saves them in the Chrome trace
+ * event format (viewable in chrome://tracing or Perfetto). Nothing is
+ * recorded until trace_enable() has been called. All functions are safe to
+ * call from any thread. */
+
+void trace_enable();
+bool trace_enabled();
+
+/* Spans on the calling thread. Spans must be closed in reverse order */
+void trace_begin(const char* name);
+void trace_end(const char* name);
+
+/* Records the current value of a counter */
+void trace_counter(const char* name, uint64_t value);
+
+/* Microseconds since tracing was enabled */
+uint64_t trace_now();
+
+/* Records a span on a separately named lane. For work we can only observe
+ * from outside, such as threads owned by libraries */
+void trace_span(const char* lane, const char* name, uint64_t start, uint64_t end);
+
+bool trace_write(const std::filesystem::path& path);
+
+/* Closes the span when it goes out of scope, or at end() if that's sooner */
+class TraceScope {
+public:
+    TraceScope(const char* name)
+        : m_Name(name) {
+        trace_begin(m_Name);
+    }
+
+    ~TraceScope() {
+        end();
+    }
+
+    void end() {
+        if(m_Name) {
+            trace_end(m_Name);
+            m_Name = nullptr;
+        }
+    }
+
+private:
+    const char* m_Name;
+};
@@ -0,0 +1,101 @@
+#include "wav.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+std::optional<WavData> find_wav_data(const std::string& filename, bool verbose) {
+    std::optional<WavData> data;
+
+    std::ifstream file(filename, std::ios::binary);
+    if(!file.good()) {
+        std::cerr << "Couldn't load .wav file: " << filename << std::endl;
+        return std::optional<WavData>();
+    }
+
+    char buffer[4];
+
+    file.read(buffer, 4);
+    if(std::strncmp(buffer, "RIFF", 4) != 0) {
+        std::cerr << "Not a valid .wav file: " << filename << std::endl;
+        return std::optional<WavData>();
+    }
+
+    file.seekg(4, std::ios_base::cur); // file length
+    file.read(buffer, 4);
+
+    if(std::strncmp(buffer, "WAVE", 4) != 0) {
+        std::cerr << "Not a valid .wav file: " << filename << std::endl;
+        return std::optional<WavData>();
+    }
+
+    while(!file.eof()) {
+        file.read(buffer, 4);  // Chunk id
+
+        if (verbose) {
+            std::cout << "Chunk ID is " << buffer[0] << buffer[1] << buffer[2] << buffer[3] << std::endl;
+        }
+
+        if(std::strncmp(buffer, "fmt ", 4) == 0) {
+
+            /* Check the format */
+            struct Format {
+                uint32_t length;
+                uint16_t type;
+                uint16_t channels;
+                uint32_t frequency;
+                uint32_t rate;
+                uint16_t bytes_per_sample;
+                uint16_t bitrate;
+            } format;
+
+            file.read((char*) &format, sizeof(format));
+
+            if (verbose) {
+                std::cout << std::dec;
+                std::cout << "  Length is " << format.length << std::endl;
+                std::cout << "  Channels is " << format.channels << std::endl;
+                std::cout << "  Frequency is " << format.frequency << std::endl;
+            }
+
+            if(format.frequency != 44100 || format.channels != 2 || format.bitrate != 16) {
+                std::cerr << "Unsupported .wav format. Must be stereo, 44100hz, and 16 bit samples.: " << filename << std::endl;
+                return std::optional<WavData>();
+            }
+
+        } else if(std::strncmp(buffer, "data", 4) == 0) {
+
+            if (verbose) {
+                std::cout << "  Data chunk" << std::endl;
+            }
+
+            uint32_t length;
+            file.read((char*) &length, sizeof(length));
+            data = WavData{file.tellg(), length};
+            break;
+
+        } else {
+            uint32_t skip;
+            file.read((char*) &skip, sizeof(skip));
+            file.seekg(skip, std::ios_base::cur);
+
+            if (verbose) {
+                std::cout << "  Skipped " << skip << " bytes" << std::endl;
+            }
+            continue;
+        }
+    }
+
+    if(!data) {
+        std::cerr << "No data chunk in .wav file: " << filename << std::endl;
+    }
+
+    return data;
+}
+
+bool read_wav_data(const std::string& filename, const WavData& wav, uint8_t* out) {
+    std::ifstream file(filename, std::ios::binary);
+    file.seekg(wav.offset);
+    file.read((char*) out, wav.length);
+    return file.gcount() == std::streamsize(wav.length);
+}
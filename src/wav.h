@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <ios>
+#include <optional>
+#include <string>
+
+/* Where the samples are in a .wav file. CDDA tracks are the raw samples */
+struct WavData {
+    std::streamoff offset;
+    uint32_t length;
+};
+
+/* Finds the sample data, checking it's stereo 16 bit 44100hz. Errors are
+ * reported on stderr, verbose also logs each chunk */
+std::optional<WavData> find_wav_data(const std::string& filename, bool verbose);
+
+/* Reads the samples into out, which must hold wav.length bytes. Returns false
+ * if the file is shorter than the data chunk claims, anything missing is
+ * left as it was in out */
+bool read_wav_data(const std::string& filename, const WavData& wav, uint8_t* out);
@@ -0,0 +1,211 @@
+#include "xa_files.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "disc_image/disc_image.h"
+
+static std::size_t chunk_size(const XaStream& stream) {
+    return (stream.submode & CD_SUBMODE_FORM2) ? 2324 : 2048;
+}
+
+static uint32_t read_le32(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+bool parse_interleave_file(const std::string& path, XaFile& file) {
+    std::ifstream input(path);
+    if(!input.is_open()) {
+        std::cerr << "Could not open interleave file: " << path << std::endl;
+        return false;
+    }
+
+    const std::filesystem::path base = std::filesystem::path(path).parent_path();
+
+    std::string line;
+    int line_number = 0;
+    while(std::getline(input, line)) {
+        ++line_number;
+
+        /* Skip empty lines or lines starting with a comment (#) */
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream iss(line);
+        std::string type;
+        if(!(iss >> type)) {
+            continue;
+        }
+
+        if(type == "file") {
+            std::string number, rest;
+            iss >> file.iso_path >> number >> rest;
+            if(number.empty()) {
+                number = "1";
+            }
+
+            if(file.iso_path.empty() || file.iso_path[0] != '/' || !rest.empty() || number.size() > 3 ||
+               !std::all_of(number.begin(), number.end(), ::isdigit) || std::stoul(number) > 255) {
+                std::cerr << path << ":" << line_number << ": expected file <path in the data track> [file number, 0 to 255]" << std::endl;
+                return false;
+            }
+            file.file_number = uint8_t(std::stoul(number));
+            continue;
+        }
+
+        XaStream stream;
+        unsigned int form, channel, coding;
+        std::string source;
+        iss >> form >> channel >> std::hex >> coding >> std::dec >> stream.sectors_per_cycle >> source;
+
+        const uint8_t types[] = {CD_SUBMODE_VIDEO, CD_SUBMODE_AUDIO, CD_SUBMODE_DATA};
+        const std::string names[] = {"video", "audio", "data"};
+        auto found = std::find(std::begin(names), std::end(names), type);
+
+        if(!iss || found == std::end(names) || (form != 1 && form != 2) ||
+           channel > 31 || coding > 255 || !stream.sectors_per_cycle) {
+            std::cerr << path << ":" << line_number
+                      << ": expected <video|audio|data> <form> <channel> <coding in hex> <sectors per cycle> <source>" << std::endl;
+            return false;
+        }
+
+        std::filesystem::path source_path = base / source;
+        std::error_code error;
+        stream.size = std::size_t(std::filesystem::file_size(source_path, error));
+        if(error) {
+            std::cerr << path << ":" << line_number << ": can't read " << source_path.string() << std::endl;
+            return false;
+        }
+
+        stream.source_path = source_path.string();
+        stream.channel = uint8_t(channel);
+        stream.coding = uint8_t(coding);
+        stream.submode = types[found - std::begin(names)] | CD_SUBMODE_REAL_TIME;
+        if(form == 2) {
+            stream.submode |= CD_SUBMODE_FORM2;
+        }
+
+        file.streams.push_back(std::move(stream));
+    }
+
+    if(file.iso_path.empty() || file.streams.empty()) {
+        std::cerr << path << ": an interleave file needs a file line and at least one stream" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+XaFiles::XaFiles() {
+    std::random_device random;
+    for(auto& byte : m_Tag) {
+        byte = uint8_t(random());
+    }
+}
+
+std::size_t XaFiles::add_form2_file(const std::string& iso_path, const std::string& source_path, std::size_t size) {
+    XaFile file;
+    file.iso_path = iso_path;
+
+    XaStream stream;
+    stream.source_path = source_path;
+    stream.size = size;
+    stream.submode = CD_SUBMODE_DATA | CD_SUBMODE_FORM2;
+    file.streams.push_back(std::move(stream));
+
+    return add_interleaved_file(std::move(file));
+}
+
+std::size_t XaFiles::add_interleaved_file(XaFile file) {
+    std::vector<uint32_t> chunks;
+    for(const auto& stream : file.streams) {
+        chunks.push_back(uint32_t((stream.size + chunk_size(stream) - 1) / chunk_size(stream)));
+    }
+
+    std::vector<uint32_t> next(file.streams.size(), 0);
+    bool remaining = true;
+    while(remaining) {
+        remaining = false;
+        for(uint32_t i = 0; i < file.streams.size(); ++i) {
+            for(std::size_t n = 0; n < file.streams[i].sectors_per_cycle && next[i] < chunks[i]; ++n) {
+                uint8_t extra = (next[i] + 1 == chunks[i]) ? CD_SUBMODE_EOR : 0;
+                file.sectors.push_back({i, next[i]++, extra});
+            }
+            remaining = remaining || next[i] < chunks[i];
+        }
+    }
+
+    if(!file.sectors.empty()) {
+        file.sectors.back().extra_submode |= CD_SUBMODE_EOR | CD_SUBMODE_EOF;
+    }
+
+    m_Files.push_back(std::move(file));
+    return m_Files.size() - 1;
+}
+
+int XaFiles::new_placeholder(std::size_t index, IsoStream** stream) const {
+    uint8_t tag[ISO_STREAM_TAG_SIZE];
+    std::memcpy(tag, m_Tag, sizeof(m_Tag));
+    for(int i = 0; i < 4; ++i) {
+        tag[sizeof(m_Tag) + i] = uint8_t(index >> (i * 8));
+    }
+
+    return iso_tagged_stream_new(off_t(m_Files[index].sectors.size()) * 2048, tag, stream);
+}
+
+bool XaFiles::sector_hook(void* user_data, size_t, const uint8_t* data, uint8_t subheader[4], uint8_t* payload) {
+    return ((XaFiles*) user_data)->fill_sector(data, subheader, payload);
+}
+
+bool XaFiles::fill_sector(const uint8_t* data, uint8_t subheader[4], uint8_t* payload) {
+    if(std::memcmp(data, m_Tag, sizeof(m_Tag)) != 0) {
+        return false;
+    }
+
+    uint32_t index = read_le32(data + sizeof(m_Tag));
+    uint32_t block = read_le32(data + ISO_STREAM_TAG_SIZE);
+    if(index >= m_Files.size() || block >= m_Files[index].sectors.size()) {
+        return false;
+    }
+
+    XaFile& file = m_Files[index];
+    const XaSector& sector = file.sectors[block];
+    XaStream& stream = file.streams[sector.stream];
+
+    if(!stream.file.is_open()) {
+        stream.file.open(stream.source_path, std::ios::binary);
+    }
+
+    std::size_t offset = std::size_t(sector.chunk) * chunk_size(stream);
+    std::size_t len = std::min(chunk_size(stream), stream.size - offset);
+    stream.file.seekg(std::streamoff(offset));
+    stream.file.read((char*) payload, std::streamsize(len));
+    if(!stream.file) {
+        if(!m_Failed) {
+            std::cerr << "Failed to read " << stream.source_path << std::endl;
+        }
+        m_Failed = true;
+        stream.file.clear();
+        len = 0;
+    }
+    std::memset(payload + len, 0, 2324 - len);
+
+    subheader[0] = file.file_number;
+    subheader[1] = stream.channel;
+    subheader[2] = stream.submode | sector.extra_submode;
+    subheader[3] = stream.coding;
+
+    /* Each stream is read front to back, so it's done with after its last
+     * sector */
+    if(sector.extra_submode & CD_SUBMODE_EOR) {
+        stream.file.close();
+    }
+
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "iso_streams.h"
+
+/* XA files in the data track, whose sectors aren't all plain Form 1 data:
+ * files stored as Form 2, and interleaved real-time streams.
+ *
+ * libisofs only knows Form 1, so each one is a placeholder in the ISO tree
+ * taking one 2048 byte block per sector (which is also how XA records the
+ * size of these files). The placeholder's blocks are tagged, and the data
+ * track's sector hook gives each one its subheader and data wherever they
+ * turn up. */
+
+/* One elementary stream of an XA file, read in 2048 or 2324 byte chunks
+ * depending on the form in its submode */
+struct XaStream {
+    std::string source_path;
+    std::size_t size = 0;
+
+    uint8_t channel = 0;
+    uint8_t submode = 0;
+    uint8_t coding = 0;
+
+    /* Sectors of this stream in each turn of the interleave pattern */
+    std::size_t sectors_per_cycle = 1;
+
+    std::ifstream file;
+};
+
+/* Where one sector of an XA file comes from */
+struct XaSector {
+    uint32_t stream;
+    uint32_t chunk;
+    uint8_t extra_submode;  /* EOR/EOF on the last sectors */
+};
+
+struct XaFile {
+    std::string iso_path;
+    uint8_t file_number = 0;
+    std::vector<XaStream> streams;
+    std::vector<XaSector> sectors;
+};
+
+/* Reads an interleave description. Lines starting with # are comments,
+ * the rest are whitespace separated like the sort file:
+ *
+ *   file <path in the data track> [XA file number 0 to 255, default 1]
+ *   <video|audio|data> <form 1|2> <channel> <coding> <sectors per cycle> <source>
+ *
+ * The coding is in hex, the other numbers are decimal. Sources are relative
+ * to the description. Errors are reported on stderr */
+bool parse_interleave_file(const std::string& path, XaFile& file);
+
+class XaFiles {
+public:
+    XaFiles();
+
+    /* A file stored as Form 2 data, from source_path */
+    std::size_t add_form2_file(const std::string& iso_path, const std::string& source_path, std::size_t size);
+
+    /* Lays out the streams' sectors, going round them taking each one's
+     * sectors per cycle until all of them run out */
+    std::size_t add_interleaved_file(XaFile file);
+
+    /* The placeholder for the file, to add to the ISO tree */
+    int new_placeholder(std::size_t index, IsoStream** stream) const;
+
+    const XaFile& file(std::size_t index) const {
+        return m_Files[index];
+    }
+
+    bool empty() const {
+        return m_Files.empty();
+    }
+
+    /* Set if a source couldn't be read while the image was written */
+    bool failed() const {
+        return m_Failed;
+    }
+
+    /* The data track's sector hook, with this as its user data */
+    static bool sector_hook(void* user_data, size_t sector, const uint8_t* data, uint8_t subheader[4], uint8_t* payload);
+
+private:
+    bool fill_sector(const uint8_t* data, uint8_t subheader[4], uint8_t* payload);
+
+    std::vector<XaFile> m_Files;
+
+    /* Random for each run, so the tags can't turn up in real data. The
+     * file's index follows */
+    uint8_t m_Tag[ISO_STREAM_TAG_SIZE - 4];
+    bool m_Failed = false;
+};